@@ -0,0 +1,717 @@
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <new>
+#include <numeric>
+#include <set>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#include "tqdm.hpp"
+
+// Measures the per-iteration overhead of tqdm compared to a bare loop.
+// Compile with optimizations, e.g. g++ -O2 -std=c++17 -pthread benchmark.cpp
+// Add -fopenmp to also measure omp_progress.
+
+const int num_elements = 50'000'000;
+
+#ifdef TQDM_DISABLE
+// A disabled loop must be the bare loop: the same iterators, and no state.
+// These fail to compile if tqdm sneaks anything back in.
+using disabled_vector_loop =
+  decltype(tq::tqdm(std::declval<std::vector<int>&>()).begin());
+static_assert(
+  std::is_same_v<disabled_vector_loop, std::vector<int>::iterator>);
+static_assert(std::is_same_v<decltype(tq::trange(1).begin()),
+                             decltype(tq::range<int>(1).begin())>);
+static_assert(std::is_empty_v<tq::progress_bar>);
+#endif
+
+// Bars are written here so the terminal doesn't affect the measurements.
+class null_buffer : public std::streambuf
+{
+protected:
+    int overflow(int c) override { return c; }
+    std::streamsize xsputn(const char*, std::streamsize n) override
+    {
+        return n;
+    }
+};
+
+null_buffer null_buf;
+std::ostream sink(&null_buf);
+
+volatile long long result = 0; // keeps the loops from being optimized away
+
+// Counts heap allocations, to check that refreshing a bar doesn't allocate.
+// Not inlined, or GCC sees new/delete pairs turn into malloc/free and warns
+// (-Wmismatched-new-delete).
+std::atomic<long long> num_allocations{0};
+
+[[gnu::noinline]] void* operator new(std::size_t size)
+{
+    ++num_allocations;
+    if (void* p = std::malloc(size)) return p;
+    throw std::bad_alloc();
+}
+
+[[gnu::noinline]] void operator delete(void* p) noexcept { std::free(p); }
+[[gnu::noinline]] void operator delete(void* p, std::size_t) noexcept
+{
+    std::free(p);
+}
+
+template <class F>
+double ns_per_iter(F f, long long n)
+{
+    tq::Chronometer C;
+    f();
+    return 1e9*C.peek()/n;
+}
+
+void report(const char* name, double ns, double baseline)
+{
+    std::cout << std::left << std::setw(40) << name << std::right
+              << std::fixed << std::setprecision(2) << std::setw(8) << ns
+              << " ns/iter  (+" << std::setw(6) << ns - baseline
+              << " ns overhead)\n";
+}
+
+void bench_miniters(const std::vector<int>& A)
+{
+    double bare = ns_per_iter(
+      [&A]() {
+          long long s = 0;
+          for (int a : A) s += a;
+          result = s;
+      },
+      A.size());
+
+    double every_iter = ns_per_iter(
+      [&A]() {
+          long long s = 0;
+          auto T = tq::tqdm(A);
+          T.set_ostream(sink);
+          T.set_miniters(1);
+          for (int a : T) s += a;
+          result = s;
+      },
+      A.size());
+
+    double dynamic = ns_per_iter(
+      [&A]() {
+          long long s = 0;
+          auto T = tq::tqdm(A);
+          T.set_ostream(sink);
+          for (int a : T) s += a;
+          result = s;
+      },
+      A.size());
+
+    double background = ns_per_iter(
+      [&A]() {
+          long long s = 0;
+          auto T = tq::tqdm(A);
+          T.set_ostream(sink);
+          T.render_in_background();
+          for (int a : T) s += a;
+          result = s;
+      },
+      A.size());
+
+    double latency = ns_per_iter(
+      [&A]() {
+          long long s = 0;
+          auto T = tq::tqdm(A);
+          T.set_ostream(sink);
+          T.record_latency();
+          for (int a : T) s += a;
+          result = s;
+      },
+      A.size());
+
+    double chunked = ns_per_iter(
+      [&A]() {
+          long long s = 0;
+          auto T = tq::tqdm_chunks(A, 4096);
+          T.set_ostream(sink);
+          for (auto chunk : T)
+              for (int a : chunk) s += a;
+          result = s;
+      },
+      A.size());
+
+    report("bare loop", bare, bare);
+    report("tqdm, clock read every iteration", every_iter, bare);
+    report("tqdm, dynamic miniters", dynamic, bare);
+    report("tqdm, background rendering", background, bare);
+    report("tqdm, latency histogram", latency, bare);
+    report("tqdm_chunks, 4096 per chunk", chunked, bare);
+}
+
+// What reading the time costs with each clock policy. On VMs where
+// steady_clock needs a syscall the difference is much bigger.
+void bench_clocks()
+{
+    const int num_reads = 10'000'000;
+
+    auto cost = [num_reads](auto read) {
+        return ns_per_iter(
+          [&]() {
+              long long s = 0;
+              for (int i = 0; i < num_reads; ++i) s += read();
+              result = s;
+          },
+          num_reads);
+    };
+
+    double steady = cost([]() {
+        return tq::steady_clock_policy::now().time_since_epoch().count();
+    });
+    double tsc = cost([]() { return tq::tsc_clock_policy::now(); });
+
+    tq::basic_chronometer<tq::steady_clock_policy> steady_chrono;
+    tq::basic_chronometer<tq::tsc_clock_policy> tsc_chrono;
+    double steady_peek = cost([&]() { return steady_chrono.peek() > 0; });
+    double tsc_peek = cost([&]() { return tsc_chrono.peek() > 0; });
+
+    std::cout << std::fixed << std::setprecision(2)
+              << "clock read: steady_clock " << steady << " ns, tsc "
+              << tsc << " ns"
+              << (tq::tsc_clock_policy::uses_counter() ? ""
+                                                       : " (fell back)")
+              << "; Chronometer::peek: steady_clock " << steady_peek
+              << " ns, tsc " << tsc_peek << " ns\n";
+}
+
+struct big_record
+{
+    std::array<int, 1024> data{}; // 4KB
+};
+
+// Not inlined, so that a copy of the record can't be optimized away.
+[[gnu::noinline]] int first_nonzero(const big_record& r)
+{
+    for (int x : r.data)
+        if (x != 0) return x;
+    return 0;
+}
+
+void bench_large_elements()
+{
+    std::vector<big_record> R(100'000);
+    for (std::size_t i = 0; i < R.size(); ++i) R[i].data[i%64] = i + 1;
+
+    double bare = ns_per_iter(
+      [&R]() {
+          long long s = 0;
+          for (const auto& r : R) s += first_nonzero(r);
+          result = s;
+      },
+      R.size());
+
+    double wrapped = ns_per_iter(
+      [&R]() {
+          long long s = 0;
+          auto T = tq::tqdm(R);
+          T.set_ostream(sink);
+          for (const auto& r : T) s += first_nonzero(r);
+          result = s;
+      },
+      R.size());
+
+    report("bare loop, 4KB elements", bare, bare);
+    report("tqdm, 4KB elements", wrapped, bare);
+}
+
+// Refreshing a bar must not allocate. Returns false if it did.
+bool bench_refresh_allocations()
+{
+    const int num_refreshes = 10000;
+
+    tq::progress_bar bar;
+    bar.set_ostream(sink);
+    bar.set_prefix("allocations ");
+    bar.set_min_update_time(0);
+    bar.set_output_mode(tq::output_mode::terminal); // sink isn't a tty
+    std::FILE* devnull = std::fopen("/dev/null", "w");
+    bar.set_json_output(devnull, 0); // a JSON line on every refresh too
+
+    // warm up: the suffix stream grows its buffer once.
+    for (int i = 0; i < 100; ++i)
+    {
+        bar << "i = " << i;
+        bar.update(i/100.0);
+    }
+
+    long long before = num_allocations;
+    tq::Chronometer C;
+    for (int i = 0; i < num_refreshes; ++i)
+    {
+        bar << "i = " << i;
+        bar.update(double(i)/num_refreshes);
+    }
+    double ns = 1e9*C.peek()/num_refreshes;
+    long long allocs = num_allocations - before;
+
+    bar.set_json_output(nullptr);
+    std::fclose(devnull);
+
+    std::cout << std::left << std::setw(40)
+              << "refresh (bar + JSON line every update)" << std::right
+              << std::fixed << std::setprecision(2)
+              << std::setw(8) << ns << " ns/refresh  " << allocs
+              << " heap allocations in " << num_refreshes << " refreshes\n";
+
+    if (allocs != 0) std::cout << "ERROR: refreshing allocates!\n";
+    return allocs == 0;
+}
+
+// -------------------- overhead suite --------------------
+// tqdm vs a bare loop, for each kind of range tqdm wraps and for loop bodies
+// of different costs, with and without writing a suffix every iteration.
+
+// A chain of dependent multiply-adds, so it can't be vectorized or skipped.
+[[gnu::noinline]] long long work(long long x, int reps)
+{
+    for (int i = 0; i < reps; ++i) x = x*6364136223846793005LL + 1;
+    return x;
+}
+
+// How many reps of work() take about one ns.
+double work_per_ns()
+{
+    const int reps = 100'000'000;
+    tq::Chronometer C;
+    result = work(1, reps);
+    return reps/(1e9*C.peek());
+}
+
+enum class loop_kind
+{
+    bare,
+    tqdm,
+    tqdm_with_suffix
+};
+
+template <class Bar>
+long long run_bar(Bar&& T, loop_kind kind, int reps)
+{
+    T.set_ostream(sink);
+    long long s = 0;
+    for (auto x : T)
+    {
+        s = work(s + x, reps);
+        if (kind == loop_kind::tqdm_with_suffix) T << x;
+    }
+    return s;
+}
+
+void bench_overhead()
+{
+    const std::array<double, 5> body_ns = {1, 10, 100, 1000, 10000};
+    const std::array<const char*, 5> body_names = {
+      "1ns", "10ns", "100ns", "1us", "10us"};
+    const long long max_size = 2'000'000;
+    const double time_per_measurement = 0.1; // seconds
+
+    double per_ns = work_per_ns();
+    std::vector<int> V(max_size);
+    std::iota(V.begin(), V.end(), 0);
+    std::set<int> S(V.begin(), V.end());
+
+    // One pass over the first n elements, with the given kind of loop.
+    using pass = std::function<long long(long long, loop_kind, int)>;
+    std::vector<std::pair<const char*, pass>> cases = {
+      {"vector<int>",
+       [&](long long n, loop_kind kind, int reps) {
+           auto first = V.begin();
+           auto last = V.begin() + n;
+           if (kind != loop_kind::bare)
+               return run_bar(tq::tqdm(first, last), kind, reps);
+           long long s = 0;
+           for (auto it = first; it != last; ++it) s = work(s + *it, reps);
+           return s;
+       }},
+      {"std::set<int>",
+       [&](long long n, loop_kind kind, int reps) {
+           auto first = S.begin();
+           auto last = S.find(n);
+           if (kind != loop_kind::bare)
+               return run_bar(tq::tqdm(first, last), kind, reps);
+           long long s = 0;
+           for (auto it = first; it != last; ++it) s = work(s + *it, reps);
+           return s;
+       }},
+      {"trange",
+       [&](long long n, loop_kind kind, int reps) {
+           if (kind != loop_kind::bare)
+               return run_bar(tq::trange(n), kind, reps);
+           long long s = 0;
+           for (long long i = 0; i < n; ++i) s = work(s + i, reps);
+           return s;
+       }},
+      {"rvalue vector<int>",
+       [&](long long n, loop_kind kind, int reps) {
+           std::vector<int> W(V.begin(), V.begin() + n);
+           if (kind != loop_kind::bare)
+               return run_bar(tq::tqdm(std::move(W)), kind, reps);
+           long long s = 0;
+           for (int x : W) s = work(s + x, reps);
+           return s;
+       }},
+    };
+
+    std::cout << "overhead of tqdm over a bare loop, by loop body cost:\n"
+              << std::setw(28) << "";
+    for (auto name : body_names) std::cout << std::setw(12) << name;
+    std::cout << '\n';
+
+    auto print_row = [](const std::string& name, const auto& percents) {
+        std::cout << std::left << std::setw(28) << name << std::right
+                  << std::fixed << std::setprecision(1);
+        for (double p : percents) std::cout << std::setw(11) << p << '%';
+        std::cout << '\n';
+    };
+
+    for (auto& [name, run] : cases)
+    {
+        std::array<double, body_ns.size()> plain{}, with_suffix{};
+        for (std::size_t i = 0; i < body_ns.size(); ++i)
+        {
+            int reps = std::max(1, static_cast<int>(body_ns[i]*per_ns));
+            auto n = std::min<long long>(
+              max_size, time_per_measurement*1e9/body_ns[i]);
+            auto time = [&, run = run](loop_kind kind) {
+                return ns_per_iter([&]() { result = run(n, kind, reps); }, n);
+            };
+            double bare = time(loop_kind::bare);
+            plain[i] = 100*(time(loop_kind::tqdm) - bare)/bare;
+            with_suffix[i] =
+              100*(time(loop_kind::tqdm_with_suffix) - bare)/bare;
+        }
+        print_row(name, plain);
+        print_row(std::string(name) + " + suffix", with_suffix);
+    }
+
+    // A timer runs for a fixed time, so compare the time per iteration
+    // against the body alone.
+    std::array<double, body_ns.size()> plain{}, with_suffix{};
+    for (std::size_t i = 0; i < body_ns.size(); ++i)
+    {
+        int reps = std::max(1, static_cast<int>(body_ns[i]*per_ns));
+        auto n = std::min<long long>(max_size,
+                                     time_per_measurement*1e9/body_ns[i]);
+        double bare = ns_per_iter(
+          [&]() {
+              long long s = 0;
+              for (long long j = 0; j < n; ++j) s = work(s + j, reps);
+              result = s;
+          },
+          n);
+        auto timed = [&](loop_kind kind) {
+            long long iters = 0;
+            double ns = ns_per_iter(
+              [&]() {
+                  auto T = tq::tqdm(tq::timer(time_per_measurement));
+                  T.set_ostream(sink);
+                  long long s = 0;
+                  for (double t : T)
+                  {
+                      s = work(s + iters++, reps);
+                      if (kind == loop_kind::tqdm_with_suffix) T << t;
+                  }
+                  result = s;
+              },
+              1);
+            return ns/iters;
+        };
+        plain[i] = 100*(timed(loop_kind::tqdm) - bare)/bare;
+        with_suffix[i] = 100*(timed(loop_kind::tqdm_with_suffix) - bare)/bare;
+    }
+    print_row("tqdm_timer", plain);
+    print_row("tqdm_timer + suffix", with_suffix);
+}
+
+// Many threads advancing the same bar. Also checks that no update is lost,
+// returning false if any was.
+bool bench_concurrent()
+{
+    bool ok = true;
+    const long long total = 64'000'000;
+
+    for (int num_threads = 1; num_threads <= 64; num_threads *= 2)
+    {
+        long long per_thread = total/num_threads;
+
+        std::atomic<long long> shared{0};
+        double atomic_ns = ns_per_iter(
+          [&]() {
+              std::vector<std::thread> threads;
+              for (int i = 0; i < num_threads; ++i)
+                  threads.emplace_back([&]() {
+                      for (long long j = 0; j < per_thread; ++j)
+                          shared.fetch_add(1, std::memory_order_relaxed);
+                  });
+              for (auto& t : threads) t.join();
+          },
+          total);
+
+        tq::concurrent_progress P(num_threads*per_thread);
+        P.set_ostream(sink);
+        double bar_ns = ns_per_iter(
+          [&]() {
+              std::vector<std::thread> threads;
+              for (int i = 0; i < num_threads; ++i)
+                  threads.emplace_back([&]() {
+                      for (long long j = 0; j < per_thread; ++j) P.update();
+                  });
+              for (auto& t : threads) t.join();
+              P.finish();
+          },
+          total);
+
+        // Disabled bars count nothing, so there is nothing to check.
+        if (tq::enabled && P.count() != num_threads*per_thread)
+        {
+            std::cout << "ERROR: lost updates! " << P.count() << '\n';
+            ok = false;
+        }
+
+        std::cout << std::setw(2) << num_threads << " threads: "
+                  << std::fixed << std::setprecision(2) << std::setw(8)
+                  << atomic_ns << " ns/update with one shared atomic, "
+                  << std::setw(8) << bar_ns
+                  << " ns/update with concurrent_progress\n";
+    }
+    return ok;
+}
+
+// parallel_for with a trivial body: time per element against a serial loop,
+// for 1 thread up to the number of cores.
+void bench_parallel_for()
+{
+    const int n = 50'000'000;
+    std::vector<int> out(n);
+
+    double serial = ns_per_iter(
+      [&]() {
+          for (int i = 0; i < n; ++i) out[i] = i*7;
+          result = out[n/2];
+      },
+      n);
+
+    unsigned max_threads = std::max(1u, std::thread::hardware_concurrency());
+    for (unsigned num_threads = 1; num_threads <= max_threads; num_threads *= 2)
+    {
+        tq::parallel_options options;
+        options.num_threads = num_threads;
+        options.os = &sink;
+        double parallel = ns_per_iter(
+          [&]() {
+              tq::parallel_for(
+                tq::range(n), [&](int i) { out[i] = i*7; }, options);
+              result = out[n/2];
+          },
+          n);
+
+        std::cout << std::setw(2) << num_threads << " threads: "
+                  << std::fixed << std::setprecision(3) << std::setw(7)
+                  << parallel << " ns/element with parallel_for, "
+                  << std::setw(7) << serial << " serial ("
+                  << std::setprecision(2) << serial/parallel << "x)\n";
+    }
+}
+
+// Counting the lines of a file: raw fread + memchr vs tqdm_file.
+void bench_file()
+{
+    auto path = std::filesystem::temp_directory_path()/"tqdm_benchmark.txt";
+    {
+        std::ofstream out(path);
+        for (int i = 0; i < 5'000'000; ++i)
+            out << "line number " << i << " with some padding text\n";
+    }
+    double mb = std::filesystem::file_size(path)/1e6;
+
+    long long raw_lines = 0;
+    double raw = ns_per_iter(
+      [&]() {
+          std::FILE* f = std::fopen(path.c_str(), "rb");
+          std::setvbuf(f, nullptr, _IONBF, 0);
+          std::vector<char> buf(1 << 20);
+          while (std::size_t n = std::fread(buf.data(), 1, buf.size(), f))
+          {
+              const char* p = buf.data();
+              const char* end = p + n;
+              while ((p = static_cast<const char*>(
+                        std::memchr(p, '\n', end - p))))
+              {
+                  ++raw_lines;
+                  ++p;
+              }
+          }
+          std::fclose(f);
+      },
+      1);
+
+    long long tqdm_lines = 0;
+    double lines = ns_per_iter(
+      [&]() {
+          tq::tqdm_file F(path.string());
+          F.set_ostream(sink);
+          for (std::string_view line : F)
+          {
+              (void)line;
+              ++tqdm_lines;
+          }
+      },
+      1);
+
+    long long chunk_bytes = 0;
+    double chunks = ns_per_iter(
+      [&]() {
+          tq::tqdm_file F(path.string(), tq::file_split::chunks);
+          F.set_ostream(sink);
+          for (std::string_view chunk : F) chunk_bytes += chunk.size();
+      },
+      1);
+
+    if (raw_lines != tqdm_lines) std::cout << "ERROR: wrong number of lines\n";
+
+    std::cout << std::fixed << std::setprecision(0)
+              << "reading a file: raw fread " << 1e9*mb/raw
+              << " MB/s, tqdm_file lines " << 1e9*mb/lines
+              << " MB/s, tqdm_file chunks " << 1e9*mb/chunks << " MB/s\n";
+
+#ifdef TQDM_HAS_MMAP
+    long long mmap_lines = 0;
+    double mapped = ns_per_iter(
+      [&]() {
+          tq::tqdm_mmap M(path.string());
+          M.set_ostream(sink);
+          M.set_prefetch(8 << 20);
+          for (std::string_view line : M)
+          {
+              (void)line;
+              ++mmap_lines;
+          }
+      },
+      1);
+
+    if (raw_lines != mmap_lines) std::cout << "ERROR: wrong number of lines\n";
+
+    std::cout << "mapping a file: tqdm_mmap lines " << 1e9*mb/mapped
+              << " MB/s\n";
+#endif
+
+    std::filesystem::remove(path);
+}
+
+#ifdef _OPENMP
+// Two omp_progress bars ticked in the same loop, e.g. items and bytes. No
+// tick may be lost, and the master must keep drawing both during the loop.
+bool check_omp_two_bars(double reps_per_ns)
+{
+    const long long n = 10'000'000;
+    int reps = std::max(1, int(50*reps_per_ns));
+
+    std::ostringstream out1, out2;
+    tq::omp_progress P1(n), P2(2*n);
+    for (auto [P, out] : {std::pair(&P1, &out1), std::pair(&P2, &out2)})
+    {
+        P->set_ostream(*out);
+        P->set_output_mode(tq::output_mode::terminal);
+        P->set_min_update_time(0.01);
+    }
+
+    long long s = 0;
+#pragma omp parallel for schedule(dynamic, 1024) reduction(+ : s)
+    for (long long i = 0; i < n; ++i)
+    {
+        s += work(i, reps);
+        P1.tick();
+        P2.advance(2);
+    }
+    result = s;
+    bool drawn = !out1.str().empty() && !out2.str().empty();
+    P1.finish();
+    P2.finish();
+
+    bool ok = !tq::enabled || (drawn && P1.count() == n && P2.count() == 2*n);
+    if (!ok)
+        std::cout << "ERROR: two omp_progress bars: counts " << P1.count()
+                  << " and " << P2.count() << ", drawn during the loop: "
+                  << drawn << '\n';
+    return ok;
+}
+
+// omp_progress in a #pragma omp parallel for, as a percentage over the same
+// loop without a bar, for bodies of different lengths. Returns false if the
+// two-bar check fails.
+bool bench_omp()
+{
+    double reps_per_ns = work_per_ns();
+    const long long total_ns = 500'000'000;
+    int num_threads = omp_get_max_threads();
+
+    for (double body_ns : {10.0, 100.0, 1000.0})
+    {
+        int reps = std::max(1, int(body_ns*reps_per_ns));
+        long long n = std::max(1LL, (long long)(total_ns*num_threads/body_ns));
+
+        tq::Chronometer C;
+        long long s = 0;
+#pragma omp parallel for reduction(+ : s)
+        for (long long i = 0; i < n; ++i) s += work(i, reps);
+        result = s;
+        double bare = C.reset();
+
+        tq::omp_progress P(n);
+        P.set_ostream(sink);
+        s = 0;
+#pragma omp parallel for reduction(+ : s)
+        for (long long i = 0; i < n; ++i)
+        {
+            s += work(i, reps);
+            P.tick();
+        }
+        P.finish();
+        result = s;
+        double with_bar = C.peek();
+
+        std::cout << std::setw(2) << num_threads << " threads, "
+                  << std::setw(5) << int(body_ns) << " ns body: "
+                  << std::fixed << std::setprecision(2) << std::setw(6)
+                  << 100*(with_bar - bare)/bare << "% with omp_progress\n";
+        std::cout.unsetf(std::ios::fixed);
+    }
+
+    return check_omp_two_bars(reps_per_ns);
+}
+#endif
+
+int main()
+{
+    std::vector<int> A(num_elements);
+    std::iota(A.begin(), A.end(), 0);
+
+    bench_miniters(A);
+    bench_clocks();
+    bench_large_elements();
+    bool ok = bench_refresh_allocations();
+    bench_overhead();
+    ok = bench_concurrent() && ok;
+    bench_parallel_for();
+#ifdef _OPENMP
+    ok = bench_omp() && ok;
+#endif
+    bench_file();
+
+    return ok ? 0 : 1;
+}
@@ -1,4 +1,5 @@
 #include <algorithm>
+#include <cmath>
 #include <numeric>
 #include <set>
 #include <unistd.h>
@@ -57,7 +58,6 @@ void test_lvalue_2()
     T.set_prefix("tqdm from lvalue ");
     for (auto&& t : T)
     {
-        t *= 2;
         usleep(sleep_time);
         T << t;
     }
@@ -86,6 +86,37 @@ void test_trange()
     }
 }
 
+void test_lazy_suffix()
+{
+    auto A = get_vector(5000);
+    auto T = tq::tqdm(A);
+    T.set_prefix("tqdm with lazy suffix ");
+    double loss = 1.0;
+    T.watch("loss", loss);
+    T.set_postfix([&loss]() { return loss < 0.5 ? "almost there" : ""; });
+    for (auto&& t : T)
+    {
+        usleep(sleep_time);
+        loss = 1.0/std::sqrt(t - 999);
+    }
+}
+
+void test_nested()
+{
+    auto epochs = tq::trange(4);
+    epochs.set_prefix("epoch ");
+    for (int epoch : epochs)
+    {
+        auto batches = tq::trange(500);
+        batches.set_prefix("batch ");
+        for (int batch : batches)
+        {
+            usleep(sleep_time*2);
+            batches << "epoch " << epoch << " batch " << batch;
+        }
+    }
+}
+
 void test_timer()
 {
     tq::tqdm_timer timer(2.0);
@@ -107,6 +138,10 @@ int main()
     std::cout << '\n';
     test_trange();
     std::cout << '\n';
+    test_lazy_suffix();
+    std::cout << '\n';
+    test_nested();
+    std::cout << '\n';
 
     return 0;
 }
@@ -25,19 +25,78 @@
  *OTHER DEALINGS IN THE SOFTWARE.
  */
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <charconv>
 #include <chrono>
 #include <cmath>
-#include <iomanip>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <functional>
 #include <iostream>
 #include <iterator>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <optional>
+#if __cplusplus >= 202002L && __has_include(<ranges>)
+#include <ranges>
+#endif
 #include <sstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <tuple>
 #include <type_traits>
+#include <vector>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#if __has_include(<unistd.h>)
+#include <unistd.h>
+#elif defined(_WIN32)
+#include <io.h>
+#endif
+
+#if (defined(__GNUC__) || defined(__clang__)) &&                             \
+  (defined(__x86_64__) || defined(__i386__))
+#include <cpuid.h>
+#include <x86intrin.h>
+#define TQDM_HAS_TSC
+#elif (defined(__GNUC__) || defined(__clang__)) && defined(__aarch64__)
+#define TQDM_HAS_TSC
+#endif
+
+#if __has_include(<sys/mman.h>)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#define TQDM_HAS_MMAP
+#endif
 
 // -------------------- chrono stuff --------------------
 
 namespace tq
 {
 using index = std::ptrdiff_t; // maybe std::size_t, but I hate unsigned types.
+
+// Define TQDM_DISABLE to make every bar a no-op, e.g. in release builds.
+#ifdef TQDM_DISABLE
+inline constexpr bool enabled = false;
+#else
+inline constexpr bool enabled = true;
+#endif
 using time_point_t = std::chrono::time_point<std::chrono::steady_clock>;
 
 inline double elapsed_seconds(time_point_t from, time_point_t to)
@@ -46,529 +105,4265 @@ inline double elapsed_seconds(time_point_t from, time_point_t to)
     return std::chrono::duration_cast<seconds>(to - from).count();
 }
 
-class Chronometer
+// Clock policies for basic_chronometer: a time_point type, now(), and the
+// seconds between two time points.
+struct steady_clock_policy
+{
+    using time_point = time_point_t;
+
+    static time_point now() { return std::chrono::steady_clock::now(); }
+
+    static double seconds(time_point from, time_point to)
+    {
+        return elapsed_seconds(from, to);
+    }
+};
+
+// Reads the CPU's cycle counter (rdtsc on x86, cntvct_el0 on ARM), which
+// costs a few ns where steady_clock can cost a syscall (~1us on some VMs).
+// On x86 the counter's rate is calibrated against steady_clock the first
+// time it's used, spinning for calibration_time. If the counter doesn't tick
+// at a constant rate (no invariant TSC), or there's no counter we know how to
+// read, this falls back to steady_clock.
+struct tsc_clock_policy
+{
+    using time_point = std::uint64_t;
+
+    static constexpr double calibration_time = 0.002;
+
+    static time_point now()
+    {
+#ifdef TQDM_HAS_TSC
+        if (calibration().usable) return read_counter();
+#endif
+        using namespace std::chrono;
+        auto t = steady_clock::now().time_since_epoch();
+        return duration_cast<nanoseconds>(t).count();
+    }
+
+    static double seconds(time_point from, time_point to)
+    {
+        return double(to - from)*calibration().seconds_per_tick;
+    }
+
+    // false if this is really steady_clock
+    static bool uses_counter() { return calibration().usable; }
+
+private:
+    struct calibration_data
+    {
+        bool usable{false};
+        double seconds_per_tick{1e-9};
+    };
+
+    static const calibration_data& calibration()
+    {
+        static const calibration_data data = calibrate();
+        return data;
+    }
+
+#ifdef TQDM_HAS_TSC
+    static time_point read_counter()
+    {
+#ifdef __aarch64__
+        std::uint64_t ticks;
+        asm volatile("mrs %0, cntvct_el0" : "=r"(ticks));
+        return ticks;
+#else
+        return __rdtsc();
+#endif
+    }
+#endif
+
+    static calibration_data calibrate()
+    {
+        calibration_data data;
+#if defined(TQDM_HAS_TSC) && defined(__aarch64__)
+        std::uint64_t frequency;
+        asm volatile("mrs %0, cntfrq_el0" : "=r"(frequency));
+        if (frequency == 0) return data;
+        data.usable = true;
+        data.seconds_per_tick = 1.0/frequency;
+#elif defined(TQDM_HAS_TSC)
+        unsigned eax, ebx, ecx, edx;
+        if (!__get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx)) return data;
+        if (!(edx & (1u << 8))) return data; // not invariant
+
+        auto t0 = steady_clock_policy::now();
+        auto c0 = read_counter();
+        auto t1 = t0;
+        while (steady_clock_policy::seconds(t0, t1) < calibration_time)
+            t1 = steady_clock_policy::now();
+        auto c1 = read_counter();
+        if (c1 <= c0) return data;
+
+        data.usable = true;
+        data.seconds_per_tick = steady_clock_policy::seconds(t0, t1)/(c1 - c0);
+#endif
+        return data;
+    }
+};
+
+// Define TQDM_TSC_CLOCK to time every bar with the cycle counter.
+#ifdef TQDM_TSC_CLOCK
+using default_clock_policy = tsc_clock_policy;
+#else
+using default_clock_policy = steady_clock_policy;
+#endif
+
+template <class Clock = default_clock_policy>
+class basic_chronometer
 {
 public:
-    Chronometer() : start_(std::chrono::steady_clock::now()) {}
+    using time_point = typename Clock::time_point;
+
+    basic_chronometer() : start_(Clock::now()) {}
 
     double reset()
     {
         auto previous = start_;
-        start_ = std::chrono::steady_clock::now();
+        start_ = Clock::now();
 
-        return elapsed_seconds(previous, start_);
+        return Clock::seconds(previous, start_);
     }
 
     [[nodiscard]] double peek() const
     {
-        auto now = std::chrono::steady_clock::now();
+        auto now = Clock::now();
 
-        return elapsed_seconds(start_, now);
+        return Clock::seconds(start_, now);
     }
 
-    [[nodiscard]] time_point_t get_start() const { return start_; }
+    [[nodiscard]] time_point get_start() const { return start_; }
 
 private:
-    time_point_t start_;
+    time_point start_;
 };
 
-// -------------------- progress_bar --------------------
+using Chronometer = basic_chronometer<>;
+
+// -------------------- line_buffer --------------------
 inline void clamp(double& x, double a, double b)
 {
     if (x < a) x = a;
     if (x > b) x = b;
 }
 
-class progress_bar
+// Fixed-capacity char buffer the bar is rendered into, so that refreshing the
+// display never touches the heap. Anything past the capacity is dropped.
+class line_buffer
 {
 public:
-    void restart()
+    static constexpr index capacity = 1024;
+
+    void clear() { size_ = 0; }
+
+    void append(char c)
     {
-        chronometer_.reset();
-        refresh_.reset();
+        if (size_ < capacity) buf_[size_++] = c;
     }
 
-    void update(double progress)
+    void append_n(char c, index count)
     {
-        clamp(progress, 0, 1);
-
-        if (time_since_refresh() > min_time_per_update_ || progress == 0 ||
-            progress == 1)
-        {
-            reset_refresh_timer();
-            display(progress);
-        }
-        suffix_.str("");
+        count = std::max<index>(0, std::min(count, capacity - size_));
+        std::fill_n(buf_.data() + size_, count, c);
+        size_ += count;
     }
 
-    void set_ostream(std::ostream& os) { os_ = &os; }
-    void set_prefix(std::string s) { prefix_ = std::move(s); }
-    void set_bar_size(int size) { bar_size_ = size; }
-    void set_min_update_time(double time) { min_time_per_update_ = time; }
-
-    template <class T>
-    progress_bar& operator<<(const T& t)
+    void append(std::string_view s)
     {
-        suffix_ << t;
-        return *this;
+        auto count = std::min<index>(s.size(), capacity - size_);
+        std::copy_n(s.data(), count, buf_.data() + size_);
+        size_ += count;
     }
 
-    double elapsed_time() const { return chronometer_.peek(); }
-
-private:
-    void display(double progress)
+    // Fixed notation, right-aligned to width (like std::setw + std::fixed).
+    void append_fixed(double x, int precision, index width = 0)
     {
-        auto flags = os_->flags();
+        std::array<char, 64> tmp;
+        auto first = tmp.data();
+        auto last = tmp.data() + tmp.size();
+        auto res = std::to_chars(first, last, x, std::chars_format::fixed,
+                                 precision);
+        if (res.ec != std::errc())
+            res = std::to_chars(first, last, x, std::chars_format::general);
 
-        double t = chronometer_.peek();
-        double eta = t/progress - t;
-
-        std::stringstream bar;
+        index len = res.ptr - first;
+        append_n(' ', width - len);
+        append(std::string_view(first, len));
+    }
 
-        bar << '\r' << prefix_ << '{' << std::fixed << std::setprecision(1)
-            << std::setw(5) << 100*progress << "%} ";
+    // Drains whatever is in the get area of sb.
+    void append(std::streambuf& sb)
+    {
+        size_ += sb.sgetn(buf_.data() + size_, capacity - size_);
+    }
 
-        print_bar(bar, progress);
+    [[nodiscard]] const char* data() const { return buf_.data(); }
+    [[nodiscard]] index size() const { return size_; }
+    [[nodiscard]] std::string_view view() const
+    {
+        return {buf_.data(), static_cast<std::size_t>(size_)};
+    }
 
-        bar << " (" << t << "s < " << eta << "s) ";
+private:
+    std::array<char, capacity> buf_;
+    index size_{0};
+};
 
-        std::string sbar = bar.str();
-        std::string suffix = suffix_.str();
+// -------------------- bar_registry --------------------
 
-        index out_size = sbar.size() + suffix.size();
-        term_cols_ = std::max(term_cols_, out_size);
-        index num_blank = term_cols_ - out_size;
+// Keeps track of the live bars on each stream, so that several of them
+// (nested loops, or one per worker thread) can share the terminal. Each bar
+// gets its own row, ordered by creation, and every refresh rewrites all rows
+// in a single write, moving the cursor back up with ANSI escapes. While
+// there's only one bar on a stream it's drawn with a plain '\r', as always.
+class bar_registry
+{
+public:
+    static bar_registry& instance()
+    {
+        static bar_registry registry;
+        return registry;
+    }
 
-        (*os_) << sbar << suffix << std::string(num_blank, ' ') << std::flush;
+    bar_registry(const bar_registry&) = delete;
+    bar_registry(bar_registry&&) = delete;
+    bar_registry& operator=(bar_registry&&) = delete;
+    bar_registry& operator=(const bar_registry&) = delete;
+    ~bar_registry() = default;
 
-        os_->flags(flags);
-    }
+    // Bars with lower ids are drawn above bars with higher ids.
+    index next_id() { return next_id_.fetch_add(1, std::memory_order_relaxed); }
 
-    void print_bar(std::stringstream& ss, double filled) const
+    // line is the bar's full line, starting with '\r'.
+    void draw(std::ostream& os, index id, std::string_view line)
     {
-        auto num_filled = static_cast<index>(std::round(filled*bar_size_));
-        ss << '[' << std::string(num_filled, '#')
-           << std::string(bar_size_ - num_filled, ' ') << ']';
-    }
+        std::lock_guard lock(mutex_);
+        screen& scr = get_screen(os);
+        find_or_add_row(scr, id).line.assign(line.substr(1));
 
-    double time_since_refresh() const { return refresh_.peek(); }
-    void reset_refresh_timer() { refresh_.reset(); }
+        if (scr.rows.size() == 1 && scr.rows_drawn <= 1)
+        {
+            os.write(line.data(), line.size());
+            scr.rows_drawn = 1;
+        }
+        else
+        {
+            redraw(scr);
+        }
+        os.flush();
+    }
 
-    Chronometer chronometer_{};
-    Chronometer refresh_{};
-    double min_time_per_update_{0.15}; // found experimentally
+    // Called when a bar dies. Its row is cleared at the next redraw.
+    void remove(index id)
+    {
+        std::lock_guard lock(mutex_);
+        for (auto& scr : screens_)
+        {
+            auto it = std::find_if(scr.rows.begin(),
+                                   scr.rows.end(),
+                                   [id](const row& r) { return r.id == id; });
+            if (it == scr.rows.end()) continue;
+            scr.rows.erase(it);
 
-    std::ostream* os_{&std::cerr};
+            // Last bar gone: leave the cursor after the last drawn row, so
+            // whatever is printed next doesn't overwrite the bars.
+            if (scr.rows.empty() && scr.rows_drawn > 1)
+            {
+                scr.out.clear();
+                append_escape(scr.out, scr.rows_drawn - 1, 'B');
+                scr.os->write(scr.out.data(), scr.out.size());
+                scr.os->flush();
+            }
+            if (scr.rows.empty()) scr.rows_drawn = 0;
+        }
+    }
 
-    index bar_size_{40};
-    index term_cols_{1};
+private:
+    bar_registry() = default;
 
-    std::string prefix_{};
-    std::stringstream suffix_{};
-};
+    struct row
+    {
+        index id;
+        std::string line;
+    };
 
-// -------------------- iter_wrapper --------------------
+    struct screen
+    {
+        std::ostream* os;
+        std::vector<row> rows{}; // sorted by id
+        index rows_drawn{0};
+        std::string out{}; // reused, so redrawing doesn't allocate
+    };
 
-template <class ForwardIter, class Parent>
-class iter_wrapper
-{
-public:
-    using iterator_category = typename ForwardIter::iterator_category;
-    using value_type = typename ForwardIter::value_type;
-    using difference_type = typename ForwardIter::difference_type;
-    using pointer = typename ForwardIter::pointer;
-    using reference = typename ForwardIter::reference;
+    screen& get_screen(std::ostream& os)
+    {
+        for (auto& scr : screens_)
+            if (scr.os == &os) return scr;
+        return screens_.emplace_back(screen{&os});
+    }
 
-    iter_wrapper(ForwardIter it, Parent* parent) : current_(it), parent_(parent)
-    {}
+    static row& find_or_add_row(screen& scr, index id)
+    {
+        auto it = std::lower_bound(
+          scr.rows.begin(), scr.rows.end(), id, [](const row& r, index i) {
+              return r.id < i;
+          });
+        if (it == scr.rows.end() || it->id != id)
+            it = scr.rows.insert(it, row{id, {}});
+        return *it;
+    }
 
-    auto operator*() { return *current_; }
+    // Writes all rows top to bottom (blanking rows of bars that are gone)
+    // and moves the cursor back to the first one.
+    static void redraw(screen& scr)
+    {
+        index num_rows = scr.rows.size();
+        index total = std::max(num_rows, scr.rows_drawn);
 
-    void operator++() { ++current_; }
+        scr.out.clear();
+        for (index i = 0; i < total; ++i)
+        {
+            scr.out += '\r';
+            if (i < num_rows) scr.out += scr.rows[i].line;
+            scr.out += "\x1b[K"; // clear to the end of the line
+            if (i + 1 < total) scr.out += '\n';
+        }
+        if (total > 1) append_escape(scr.out, total - 1, 'A');
 
-    template <class Other>
-    bool operator!=(const Other& other) const
-    {
-        parent_->update(); // here and not in ++ because I need to run update
-                           // before first advancement!
-        return current_ != other;
+        scr.os->write(scr.out.data(), scr.out.size());
+        scr.rows_drawn = num_rows;
     }
 
-    bool operator!=(const iter_wrapper& other) const
+    // Appends "ESC [ n cmd", e.g. cursor up n rows.
+    static void append_escape(std::string& out, index n, char cmd)
     {
-        parent_->update(); // here and not in ++ because I need to run update
-                           // before first advancement!
-        return current_ != other.current_;
+        std::array<char, 24> num;
+        auto res = std::to_chars(num.data(), num.data() + num.size(), n);
+        out += "\x1b[";
+        out.append(num.data(), res.ptr);
+        out += cmd;
     }
 
-    [[nodiscard]] const ForwardIter& get() const { return current_; }
+    std::mutex mutex_;
+    std::vector<screen> screens_;
+    std::atomic<index> next_id_{0};
+};
 
-private:
-    friend Parent;
-    ForwardIter current_;
-    Parent* parent_;
+// -------------------- shared_progress --------------------
+
+// The state of a bar, as published in shared memory for other processes.
+struct shared_snapshot
+{
+    std::int64_t pid;
+    std::int64_t id; // of the bar within its process
+    double start_time; // seconds since the unix epoch
+    std::int64_t n;    // -1 if unknown
+    std::int64_t total; // -1 if unknown
+    double elapsed;    // seconds, as of the last update
+    double progress;
+    double rate; // iterations per second
+    std::string label;
 };
 
-// -------------------- tqdm_for_lvalues --------------------
+// Where bars publish their state: $TQDM_SHM_DIR if set, else /dev/shm if it
+// exists (so it's memory only), else the temp directory.
+inline std::filesystem::path shared_progress_dir()
+{
+    if (const char* dir = std::getenv("TQDM_SHM_DIR")) return dir;
+    std::error_code ec;
+    if (std::filesystem::is_directory("/dev/shm", ec)) return "/dev/shm";
+    return std::filesystem::temp_directory_path();
+}
 
-template <class ForwardIter, class EndIter = ForwardIter>
-class tqdm_for_lvalues
+// One small mmap'd file per bar, named tqdm-<pid>-<id>, guarded by a seqlock:
+// publishing is a handful of plain stores, never blocks on readers, and a
+// reader that races with a write just retries.
+class shared_progress
 {
 public:
-    using this_t = tqdm_for_lvalues<ForwardIter, EndIter>;
-    using iterator = iter_wrapper<ForwardIter, this_t>;
-    using value_type = typename ForwardIter::value_type;
-    using size_type = index;
-    using difference_type = index;
+    static constexpr std::size_t label_size = 64;
 
-    tqdm_for_lvalues(ForwardIter begin, EndIter end)
-        : first_(begin, this), last_(end), num_iters_(std::distance(begin, end))
-    {}
+    shared_progress() = default;
+    shared_progress(const shared_progress&) = delete;
+    shared_progress(shared_progress&&) = delete;
+    shared_progress& operator=(shared_progress&&) = delete;
+    shared_progress& operator=(const shared_progress&) = delete;
+    ~shared_progress() { close(); }
 
-    tqdm_for_lvalues(ForwardIter begin, EndIter end, index total)
-        : first_(begin, this), last_(end), num_iters_(total)
-    {}
+    [[nodiscard]] bool is_open() const { return rec_ != nullptr; }
 
-    template <class Container>
-    explicit tqdm_for_lvalues(Container& C)
-        : first_(C.begin(), this), last_(C.end()), num_iters_(C.size())
-    {}
+#ifdef TQDM_HAS_MMAP
+    void open(index id)
+    {
+        if (rec_) return;
+        auto name = "tqdm-" + std::to_string(getpid()) + "-" +
+          std::to_string(id);
+        path_ = (shared_progress_dir()/name).string();
 
-    template <class Container>
-    explicit tqdm_for_lvalues(const Container& C)
-        : first_(C.begin(), this), last_(C.end()), num_iters_(C.size())
-    {}
+        int fd = ::open(path_.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) throw std::runtime_error("tqdm: can't create " + path_);
+        void* p = MAP_FAILED;
+        if (ftruncate(fd, sizeof(record)) == 0)
+            p = mmap(nullptr, sizeof(record), PROT_READ | PROT_WRITE,
+                     MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (p == MAP_FAILED)
+        {
+            unlink(path_.c_str());
+            throw std::runtime_error("tqdm: can't map " + path_);
+        }
 
-    tqdm_for_lvalues(const tqdm_for_lvalues&) = delete;
-    tqdm_for_lvalues(tqdm_for_lvalues&&) = delete;
-    tqdm_for_lvalues& operator=(tqdm_for_lvalues&&) = delete;
-    tqdm_for_lvalues& operator=(const tqdm_for_lvalues&) = delete;
-    ~tqdm_for_lvalues() = default;
+        rec_ = new (p) record{};
+        rec_->pid = getpid();
+        rec_->id = id;
+        restart();
+        rec_->magic.store(record::magic_value, std::memory_order_release);
+    }
 
-    template <class Container>
-    tqdm_for_lvalues(Container&&) = delete; // prevent misuse!
+    void close()
+    {
+        if (!rec_) return;
+        munmap(rec_, sizeof(record));
+        unlink(path_.c_str());
+        rec_ = nullptr;
+    }
 
-    iterator begin()
+    void restart()
     {
-        bar_.restart();
-        iters_done_ = 0;
-        return first_;
+        using namespace std::chrono;
+        auto now = system_clock::now().time_since_epoch();
+        begin_write();
+        rec_->start_time.store(duration<double>(now).count(),
+                               std::memory_order_relaxed);
+        end_write();
     }
 
-    EndIter end() const { return last_; }
+    void set_label(std::string_view label)
+    {
+        label_.fill('\0');
+        std::copy_n(label.data(),
+                    std::min(label.size(), label_size - 1),
+                    label_.data());
+        label_changed_ = true;
+    }
 
-    void update()
+    void publish(index n, index total, double elapsed, double progress,
+                 double rate)
     {
-        ++iters_done_;
-        bar_.update(calc_progress());
+        begin_write();
+        rec_->n.store(n, std::memory_order_relaxed);
+        rec_->total.store(total, std::memory_order_relaxed);
+        rec_->elapsed.store(elapsed, std::memory_order_relaxed);
+        rec_->progress.store(progress, std::memory_order_relaxed);
+        rec_->rate.store(rate, std::memory_order_relaxed);
+        if (label_changed_)
+        {
+            for (std::size_t i = 0; i < label_size; ++i)
+                rec_->label[i].store(label_[i], std::memory_order_relaxed);
+            label_changed_ = false;
+        }
+        end_write();
     }
 
-    void set_ostream(std::ostream& os) { bar_.set_ostream(os); }
-    void set_prefix(std::string s) { bar_.set_prefix(std::move(s)); }
-    void set_bar_size(int size) { bar_.set_bar_size(size); }
-    void set_min_update_time(double time) { bar_.set_min_update_time(time); }
+    // How many times read() retries a snapshot that keeps changing under
+    // it. A writer that died halfway leaves the record odd forever.
+    static constexpr int max_read_tries = 1000;
 
-    template <class T>
-    tqdm_for_lvalues& operator<<(const T& t)
+    // Reads the bar published at path. Returns nullopt if it's not a bar,
+    // or if no consistent snapshot could be read.
+    static std::optional<shared_snapshot>
+    read(const std::filesystem::path& path)
     {
-        bar_ << t;
-        return *this;
+        std::error_code ec;
+        if (std::filesystem::file_size(path, ec) != sizeof(record) || ec)
+            return std::nullopt;
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) return std::nullopt;
+        void* p = mmap(nullptr, sizeof(record), PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (p == MAP_FAILED) return std::nullopt;
+
+        const auto* rec = static_cast<const record*>(p);
+        bool ok =
+          rec->magic.load(std::memory_order_acquire) == record::magic_value;
+        shared_snapshot out{};
+        if (ok)
+        {
+            out.pid = rec->pid;
+            out.id = rec->id;
+            std::array<char, label_size> label;
+            ok = false;
+            for (int tries = 0; tries < max_read_tries && !ok; ++tries)
+            {
+                if (tries > 0) std::this_thread::yield();
+                auto seq = rec->seq.load(std::memory_order_acquire);
+                if (seq & 1) continue; // being written right now
+                out.start_time =
+                  rec->start_time.load(std::memory_order_relaxed);
+                out.n = rec->n.load(std::memory_order_relaxed);
+                out.total = rec->total.load(std::memory_order_relaxed);
+                out.elapsed = rec->elapsed.load(std::memory_order_relaxed);
+                out.progress = rec->progress.load(std::memory_order_relaxed);
+                out.rate = rec->rate.load(std::memory_order_relaxed);
+                for (std::size_t i = 0; i < label_size; ++i)
+                    label[i] = rec->label[i].load(std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_acquire);
+                ok = rec->seq.load(std::memory_order_relaxed) == seq;
+            }
+            label.back() = '\0';
+            out.label = label.data();
+        }
+        munmap(p, sizeof(record));
+        if (!ok) return std::nullopt;
+        return out;
     }
 
-    void manually_set_progress(double to)
+private:
+    // Fields are atomics so that torn reads are well-defined; the seqlock
+    // is what makes a snapshot consistent.
+    struct record
     {
-        clamp(to, 0, 1);
-        iters_done_ = std::round(to*num_iters_);
+        static constexpr std::uint64_t magic_value = 0x31766d6864717471;
+
+        std::atomic<std::uint64_t> magic{0}; // set once pid is written
+        std::int64_t pid{0};
+        std::int64_t id{0};
+        std::atomic<std::uint64_t> seq{0}; // odd while being written
+        std::atomic<double> start_time{0};
+        std::atomic<std::int64_t> n{-1};
+        std::atomic<std::int64_t> total{-1};
+        std::atomic<double> elapsed{0};
+        std::atomic<double> progress{0};
+        std::atomic<double> rate{0};
+        std::array<std::atomic<char>, label_size> label{};
+    };
+
+    void begin_write()
+    {
+        auto seq = rec_->seq.load(std::memory_order_relaxed);
+        rec_->seq.store(seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
     }
 
-private:
-    double calc_progress() const
+    void end_write()
     {
-        double denominator = num_iters_;
-        if (num_iters_ == 0) denominator += 1e-9;
-        return iters_done_/denominator;
+        auto seq = rec_->seq.load(std::memory_order_relaxed);
+        rec_->seq.store(seq + 1, std::memory_order_release);
     }
 
-    iterator first_;
-    EndIter last_;
-    index num_iters_{0};
-    index iters_done_{0};
-    progress_bar bar_;
+    record* rec_{nullptr};
+    std::string path_{};
+    std::array<char, label_size> label_{};
+    bool label_changed_{false};
+#else
+    void open(index) {}
+    void close() {}
+    void restart() {}
+    void set_label(std::string_view) {}
+    void publish(index, index, double, double, double) {}
+    static std::optional<shared_snapshot>
+    read(const std::filesystem::path&)
+    {
+        return std::nullopt;
+    }
+
+private:
+    void* rec_{nullptr};
+#endif
 };
 
-template <class Container>
-tqdm_for_lvalues(Container&) -> tqdm_for_lvalues<typename Container::iterator>;
+struct shared_file
+{
+    std::filesystem::path path;
+    std::int64_t pid;
+    std::int64_t id;
+};
 
-template <class Container>
-tqdm_for_lvalues(const Container&)
-  -> tqdm_for_lvalues<typename Container::const_iterator>;
+// The files bars published on this host (or only those of process pid),
+// sorted by pid and creation order. The pid and id come from the file name,
+// so callers can skip files of dead processes without reading them.
+inline std::vector<shared_file> shared_files(std::int64_t pid = -1)
+{
+    // Parses the number in s up to the first '-', and moves s past it.
+    auto parse = [](std::string_view& s, std::int64_t& value) {
+        auto end = s.data() + std::min(s.find('-'), s.size());
+        auto res = std::from_chars(s.data(), end, value);
+        if (res.ec != std::errc() || res.ptr != end) return false;
+        s.remove_prefix(std::min(s.size(), std::size_t(end - s.data()) + 1));
+        return true;
+    };
 
-// -------------------- tqdm_for_rvalues --------------------
+    std::vector<shared_file> files;
+    std::error_code ec;
+    for (const auto& entry :
+         std::filesystem::directory_iterator(shared_progress_dir(), ec))
+    {
+        auto name = entry.path().filename().string();
+        std::string_view rest = name;
+        if (rest.rfind("tqdm-", 0) != 0) continue;
+        rest.remove_prefix(5);
+        shared_file file{entry.path(), 0, 0};
+        if (!parse(rest, file.pid) || !parse(rest, file.id) || !rest.empty())
+            continue;
+        if (pid < 0 || file.pid == pid) files.push_back(std::move(file));
+    }
+    std::sort(files.begin(), files.end(), [](const auto& a, const auto& b) {
+        return std::tie(a.pid, a.id) < std::tie(b.pid, b.id);
+    });
+    return files;
+}
 
-template <class Container>
-class tqdm_for_rvalues
+// All the bars published on this host (or only those of process pid), in
+// order of creation within each process. Bars of processes that died
+// without cleaning up are included, unless they died mid-write.
+inline std::vector<shared_snapshot> shared_bars(std::int64_t pid = -1)
 {
-public:
-    using iterator = typename Container::iterator;
-    using const_iterator = typename Container::const_iterator;
-    using value_type = typename Container::value_type;
+    std::vector<shared_snapshot> bars;
+    for (const auto& file : shared_files(pid))
+    {
+        if (auto bar = shared_progress::read(file.path))
+            bars.push_back(std::move(*bar));
+    }
+    return bars;
+}
 
-    explicit tqdm_for_rvalues(Container&& C)
-        : C_(std::forward<Container>(C)), tqdm_(C_)
-    {}
+// -------------------- latency_histogram --------------------
 
-    auto begin() { return tqdm_.begin(); }
+// Fixed-size log-linear histogram of durations, like HdrHistogram: values
+// below 2^sub_bits ns get a bucket each, and every power of two above that is
+// split into 2^sub_bits buckets, so any value is known within ~3% and
+// recording one is a few instructions without any allocation. Written by a
+// single thread; the counts are atomics only so the bar can be rendered from
+// another one.
+class latency_histogram
+{
+public:
+    static constexpr int sub_bits = 5;
+    static constexpr index sub_count = index(1) << sub_bits;
+    static constexpr index num_buckets = (64 - sub_bits + 1)*sub_count;
 
-    auto end() { return tqdm_.end(); }
+    using nanoseconds = std::uint64_t;
 
-    void update() { return tqdm_.update(); }
+    void clear()
+    {
+        for (auto& c : counts_) c.store(0, std::memory_order_relaxed);
+        total_.store(0, std::memory_order_relaxed);
+        max_.store(0, std::memory_order_relaxed);
+    }
 
-    void set_ostream(std::ostream& os) { tqdm_.set_ostream(os); }
-    void set_prefix(std::string s) { tqdm_.set_prefix(std::move(s)); }
-    void set_bar_size(int size) { tqdm_.set_bar_size(size); }
-    void set_min_update_time(double time) { tqdm_.set_min_update_time(time); }
+    void record(nanoseconds value, index count = 1)
+    {
+        auto& bucket = counts_[bucket_of(value)];
+        store(bucket, bucket.load(std::memory_order_relaxed) + count);
+        store(total_, total_.load(std::memory_order_relaxed) + count);
+        if (value > max_.load(std::memory_order_relaxed)) store(max_, value);
+    }
 
-    template <class T>
-    auto& operator<<(const T& t)
+    [[nodiscard]] index count() const
     {
-        return tqdm_ << t;
+        return total_.load(std::memory_order_relaxed);
     }
 
-    void advance(index amount) { tqdm_.advance(amount); }
+    [[nodiscard]] nanoseconds max() const
+    {
+        return max_.load(std::memory_order_relaxed);
+    }
 
-    void manually_set_progress(double to) { tqdm_.manually_set_progress(to); }
+    // The value below which a fraction q of the recorded values fall
+    // (the middle of its bucket).
+    [[nodiscard]] nanoseconds percentile(double q) const
+    {
+        auto total = count();
+        if (total == 0) return 0;
+        auto rank = static_cast<index>(std::ceil(q*total));
+        rank = std::max<index>(rank, 1);
+        index seen = 0;
+        for (index i = 0; i < num_buckets; ++i)
+        {
+            seen += counts_[i].load(std::memory_order_relaxed);
+            if (seen >= rank)
+                return std::min(bucket_lower(i) + bucket_width(i)/2, max());
+        }
+        return max();
+    }
+
+    // One line per non-empty bucket: value, count and cumulative percentile.
+    void print(std::ostream& os) const
+    {
+        auto total = count();
+        os << "  value (us)        count  percentile\n";
+        index seen = 0;
+        for (index i = 0; i < num_buckets; ++i)
+        {
+            index c = counts_[i].load(std::memory_order_relaxed);
+            if (c == 0) continue;
+            seen += c;
+            double value = (bucket_lower(i) + bucket_width(i)/2)*1e-3;
+            std::array<char, 80> line;
+            std::snprintf(line.data(), line.size(), "%12.3f %12lld %10.5f%%\n",
+                          value, static_cast<long long>(c), 100.0*seen/total);
+            os << line.data();
+        }
+        os << "  " << total << " values, max " << max()*1e-3 << " us\n";
+    }
 
 private:
-    Container C_;
-    tqdm_for_lvalues<iterator> tqdm_;
-};
+    static int bit_width(nanoseconds v)
+    {
+#if defined(__GNUC__) || defined(__clang__)
+        return v == 0 ? 0 : 64 - __builtin_clzll(v);
+#else
+        int w = 0;
+        for (; v != 0; v >>= 1) ++w;
+        return w;
+#endif
+    }
 
-template <class Container>
-tqdm_for_rvalues(Container &&) -> tqdm_for_rvalues<Container>;
+    static index bucket_of(nanoseconds v)
+    {
+        if (v < nanoseconds(sub_count)) return static_cast<index>(v);
+        int shift = bit_width(v) - 1 - sub_bits;
+        return (shift + 1)*sub_count + static_cast<index>(v >> shift) -
+          sub_count;
+    }
 
-// -------------------- tqdm --------------------
-template <class ForwardIter>
-auto tqdm(const ForwardIter& first, const ForwardIter& last)
+    static nanoseconds bucket_lower(index i)
+    {
+        if (i < sub_count) return i;
+        index shift = i/sub_count - 1;
+        return nanoseconds(sub_count + i%sub_count) << shift;
+    }
+
+    static nanoseconds bucket_width(index i)
+    {
+        return i < sub_count ? 1 : nanoseconds(1) << (i/sub_count - 1);
+    }
+
+    template <class T>
+    static void store(std::atomic<T>& a, T value)
+    {
+        a.store(value, std::memory_order_relaxed);
+    }
+
+    std::array<std::atomic<index>, num_buckets> counts_{};
+    std::atomic<index> total_{0};
+    std::atomic<nanoseconds> max_{0};
+};
+
+// -------------------- progress_bar --------------------
+
+enum class unit_scale
 {
-    return tqdm_for_lvalues(first, last);
-}
+    none,
+    si,
+    iec
+};
 
-template <class ForwardIter>
-auto tqdm(const ForwardIter& first, const ForwardIter& last, index total)
+// terminal redraws the bar in place. log prints one line per refresh, at a
+// much lower rate, which is what you want when the output goes to a file, a
+// pipe or a CI log. automatic picks terminal only if the stream is a tty.
+enum class output_mode
 {
-    return tqdm_for_lvalues(first, last, total);
-}
+    automatic,
+    terminal,
+    log
+};
 
-template <class Container>
-auto tqdm(const Container& C)
+// Only std::cout, std::cerr and std::clog can be mapped to a file descriptor;
+// any other stream is assumed not to be a terminal.
+inline bool is_terminal(const std::ostream& os)
 {
-    return tqdm_for_lvalues(C);
+    int fd = -1;
+    if (&os == &std::cout) fd = 1;
+    if (&os == &std::cerr || &os == &std::clog) fd = 2;
+    if (fd < 0) return false;
+#if __has_include(<unistd.h>)
+    return isatty(fd);
+#elif defined(_WIN32)
+    return _isatty(fd);
+#else
+    return true;
+#endif
 }
 
-template <class Container>
-auto tqdm(Container& C)
+#ifndef TQDM_DISABLE
+
+class progress_bar
+{
+public:
+    progress_bar() = default;
+    progress_bar(const progress_bar&) = delete;
+    progress_bar(progress_bar&&) = delete;
+    progress_bar& operator=(progress_bar&&) = delete;
+    progress_bar& operator=(const progress_bar&) = delete;
+    ~progress_bar()
+    {
+        bar_registry::instance().remove(id_);
+        close_json();
+    }
+
+    void restart()
+    {
+        chronometer_.reset();
+        last_refresh_ = 0;
+        last_check_ = 0;
+        iters_since_check_ = 0;
+        iters_checked_ = 0;
+        suffix_stale_ = true;
+        rates_ = {};
+        next_log_progress_ = 0;
+        logged_done_ = false;
+        last_json_ = -1;
+        json_done_ = false;
+        if (shared_.is_open()) shared_.restart();
+    }
+
+    // Meant to be called once per iteration, before update(). Reading the
+    // clock costs more than many loop bodies, so the time is only checked
+    // every miniters_ iterations.
+    bool skip_check() { return ++iters_since_check_ < miniters_; }
+
+    // count is the number of iterations done, if known (negative if not).
+    // It's only used to display the rate in it/s.
+    void update(double progress, index count = -1)
+    {
+        clamp(progress, 0, 1);
+        count_ = count;
+
+        double t = chronometer_.peek();
+        adapt_miniters(t);
+
+        if (logging() ? time_to_log(progress, t)
+                      : time_to_draw(progress, t))
+        {
+            last_refresh_ = t;
+            display(progress, t);
+        }
+        if (json_ && time_to_emit_json(progress, t)) emit_json(progress, t);
+        if (shared_.is_open()) publish_shared(progress, t);
+        suffix_stale_ = true;
+    }
+
+    // Displays right away, regardless of when the last refresh was. In log
+    // mode the final line is still only printed once.
+    void redraw(double progress, index count = -1)
+    {
+        clamp(progress, 0, 1);
+        count_ = count;
+        double t = chronometer_.peek();
+        if (json_ && !(json_done_ && progress == 1)) emit_json(progress, t);
+        if (shared_.is_open()) publish_shared(progress, t);
+        if (logging() && logged_done_ && progress == 1) return;
+        last_refresh_ = t;
+        display(progress, t);
+    }
+
+    void set_ostream(std::ostream& os)
+    {
+        os_ = &os;
+        os_is_terminal_ = is_terminal(os);
+    }
+
+    void set_output_mode(output_mode mode) { mode_ = mode; }
+
+    // Besides drawing the bar, write its state to f as one JSON object per
+    // line, at the start, every `interval` seconds and at the end, e.g.
+    //   {"name":"train","n":120,"total":1000,"elapsed":3.200,"rate":37.500,
+    //    "eta":23.467,"progress":0.1200,"postfix":"loss = 0.3"}
+    // The name is the prefix without trailing spaces or colons. Unknown
+    // fields are null. Each line is written with a single fwrite, and
+    // formatting it doesn't allocate. nullptr turns it off.
+    void set_json_output(std::FILE* f, double interval = 1)
+    {
+        close_json();
+        json_ = f;
+        json_interval_ = interval;
+    }
+
+    // Same, appending to the file at path.
+    void set_json_output(const std::string& path, double interval = 1)
+    {
+        std::FILE* f = std::fopen(path.c_str(), "a");
+        if (!f) throw std::runtime_error("tqdm: can't open " + path);
+        set_json_output(f, interval);
+        json_owned_ = true;
+    }
+
+    // Publish the bar's state (count, total, rate, label...) in a small
+    // shared memory file that other processes can poll (see tqtop.cpp), at
+    // the cost of a few stores per update. Only on POSIX systems.
+    void set_shared_export(bool on = true)
+    {
+        if (!on)
+        {
+            shared_.close();
+            return;
+        }
+        shared_.open(id_);
+        shared_.set_label(name());
+    }
+
+    // In log mode, a line is printed every `seconds` and every time progress
+    // crosses a multiple of progress_step (0 to disable either), plus once at
+    // the start and once at the end.
+    void set_log_interval(double seconds, double progress_step = 0.1)
+    {
+        log_interval_ = seconds;
+        log_progress_step_ = progress_step;
+    }
+
+    void set_prefix(std::string s)
+    {
+        prefix_ = std::move(s);
+        if (shared_.is_open()) shared_.set_label(name());
+    }
+    void set_bar_size(int size) { bar_size_ = size; }
+    void set_min_update_time(double time) { min_time_per_update_ = time; }
+
+    // Weight of the latest measurement in the exponential moving average of
+    // the rate, which the ETA is computed from. 0 means use the average
+    // since the start, 1 means use only the latest refresh interval.
+    void set_smoothing(double alpha)
+    {
+        clamp(alpha, 0, 1);
+        smoothing_ = alpha;
+    }
+
+    // What is being counted, e.g. "B" for bytes. With a unit_scale other than
+    // none, amounts are shown with SI (k = 1000) or IEC (Ki = 1024) prefixes
+    // and the bar also shows how much of the total has been processed.
+    void set_unit(std::string unit, unit_scale scale = unit_scale::none)
+    {
+        unit_ = std::move(unit);
+        scale_ = scale;
+    }
+
+    // Show percentiles of the iteration times recorded in h (or stop, if
+    // nullptr). h must outlive the bar or be reset before it's destroyed.
+    void show_latency(const latency_histogram* h) { latency_ = h; }
+
+    // Only used for displaying "processed / total" with scaled units.
+    void set_total(index total) { total_ = total; }
+
+    // For when the total is unknown: no percentage, bar or ETA.
+    void set_indeterminate(bool on = true) { indeterminate_ = on; }
+
+    // n > 0 checks the time every n iterations. n == 0 (the default) tunes the
+    // stride from the measured iteration rate, like python's dynamic_miniters.
+    void set_miniters(index n)
+    {
+        dynamic_miniters_ = (n <= 0);
+        miniters_ = std::max<index>(n, 1);
+    }
+
+    // The suffix written with << is kept until the next iteration writes to
+    // it, so only the iterations that get displayed pay for clearing it.
+    // A write belongs to a new iteration if skip_check() or update() was
+    // called since the last one, which << works out from the iteration
+    // count, so that skip_check() stays a single increment.
+    template <class T>
+    progress_bar& operator<<(const T& t)
+    {
+        index iteration = iters_checked_ + iters_since_check_;
+        if (suffix_stale_ || iteration != suffix_iteration_)
+        {
+            suffix_.str("");
+            suffix_stale_ = false;
+            suffix_iteration_ = iteration;
+        }
+        suffix_ << t;
+        return *this;
+    }
+
+    // Lazy alternatives to <<: these are only evaluated when the bar is
+    // actually displayed, so the loop body pays nothing for them.
+    // f() must return something printable with operator<<.
+    template <class F>
+    void set_postfix(F f)
+    {
+        postfix_ = [f = std::move(f)](std::ostream& os) { os << f(); };
+    }
+
+    // Displays "name = value" using the current value of the variable.
+    template <class T>
+    void watch(std::string name, const T& value)
+    {
+        watched_.emplace_back(
+          [name = std::move(name), p = &value](std::ostream& os) {
+              os << name << " = " << *p << ' ';
+          });
+    }
+
+    template <class T>
+    void watch(std::string name, const T&& value) = delete; // would dangle!
+
+    void clear_postfix()
+    {
+        postfix_ = nullptr;
+        watched_.clear();
+    }
+
+    double elapsed_time() const { return chronometer_.peek(); }
+    double min_update_time() const { return min_time_per_update_; }
+
+    bool logging() const
+    {
+        return mode_ == output_mode::log ||
+          (mode_ == output_mode::automatic && !os_is_terminal_);
+    }
+
+private:
+    // The prefix without trailing spaces or colons, to label exported data.
+    std::string_view name() const
+    {
+        std::string_view name = prefix_;
+        auto end = name.find_last_not_of(" :\t");
+        return name.substr(0, end == name.npos ? 0 : end + 1);
+    }
+
+    bool time_to_emit_json(double progress, double t) const
+    {
+        if (progress == 1 && !indeterminate_) return !json_done_;
+        return last_json_ < 0 || t - last_json_ >= json_interval_;
+    }
+
+    void emit_json(double progress, double t)
+    {
+        // rates are normally only updated by display()
+        if (t > rates_.last_time) update_rates(progress, t);
+        double eta = seconds_left(progress);
+        bool known_count = count_ >= 0;
+        bool known_total = !indeterminate_ && total_ >= 0;
+
+        json_line_.clear();
+        json_line_.append("{\"name\":\"");
+        append_json_escaped(name(), line_buffer::capacity - json_fields_size);
+        json_line_.append("\",\"n\":");
+        append_json_number(exported_count(), 0, known_count);
+        json_line_.append(",\"total\":");
+        append_json_number(total_, 0, known_total);
+        json_line_.append(",\"elapsed\":");
+        append_json_number(t, 3, true);
+        json_line_.append(",\"rate\":");
+        append_json_number(rates_.iters_per_sec, 3, known_count);
+        json_line_.append(",\"eta\":");
+        append_json_number(eta, 3, !indeterminate_);
+        json_line_.append(",\"progress\":");
+        append_json_number(progress, 4, !indeterminate_);
+        json_line_.append(",\"postfix\":\"");
+        // leave room for the closing "}\n
+        index postfix_limit = line_buffer::capacity - 3;
+        suffix_.seekg(0);
+        append_json_escaped(*suffix_.rdbuf(), postfix_limit);
+        if (!watched_.empty() || postfix_)
+        {
+            lazy_suffix_.str("");
+            for (auto& w : watched_) w(lazy_suffix_);
+            if (postfix_) postfix_(lazy_suffix_);
+            append_json_escaped(*lazy_suffix_.rdbuf(), postfix_limit);
+        }
+        json_line_.append("\"}\n");
+
+        std::fwrite(json_line_.data(), 1, json_line_.size(), json_);
+        std::fflush(json_);
+
+        last_json_ = t;
+        if (progress == 1 && !indeterminate_) json_done_ = true;
+    }
+
+    // The total is an upper bound for exported counts, even when a loop
+    // counts past it, so that readers never see n > total.
+    index exported_count() const
+    {
+        if (indeterminate_ || total_ < 0 || count_ < 0) return count_;
+        return std::min(count_, total_);
+    }
+
+    void publish_shared(double progress, double t)
+    {
+        shared_.publish(exported_count(),
+                        indeterminate_ ? -1 : total_,
+                        t,
+                        progress,
+                        rates_.iters_per_sec);
+    }
+
+    void append_json_number(double x, int precision, bool known)
+    {
+        if (known && std::isfinite(x))
+            json_line_.append_fixed(x, precision);
+        else
+            json_line_.append("null");
+    }
+
+    // Room kept after the name for the other fields: six numbers of at most
+    // 64 characters (see line_buffer::append_fixed), their keys and the end.
+    static constexpr index json_fields_size = 512;
+
+    // Stops (returning false) before json_line_ would grow past limit, so
+    // that what follows still fits and the line stays valid JSON. Only
+    // stops at the start of a UTF-8 sequence, never in the middle of one.
+    bool append_json_escaped(std::string_view s, index limit)
+    {
+        static constexpr char hex[] = "0123456789abcdef";
+        for (char c : s)
+        {
+            auto u = static_cast<unsigned char>(c);
+            // an escape takes 6 bytes, which is more than a UTF-8 sequence
+            bool continuation = (u & 0xc0) == 0x80;
+            if (!continuation && json_line_.size() + 6 > limit) return false;
+            if (c == '"' || c == '\\')
+            {
+                json_line_.append('\\');
+                json_line_.append(c);
+            }
+            else if (u < 0x20)
+            {
+                json_line_.append("\\u00");
+                json_line_.append(hex[u >> 4]);
+                json_line_.append(hex[u & 15]);
+            }
+            else
+            {
+                json_line_.append(c);
+            }
+        }
+        return true;
+    }
+
+    void append_json_escaped(std::streambuf& sb, index limit)
+    {
+        std::array<char, 256> chunk;
+        while (auto n = sb.sgetn(chunk.data(), chunk.size()))
+        {
+            if (!append_json_escaped(std::string_view(chunk.data(), n), limit))
+                return;
+        }
+    }
+
+    void close_json()
+    {
+        if (json_owned_) std::fclose(json_);
+        json_ = nullptr;
+        json_owned_ = false;
+    }
+
+    bool time_to_draw(double progress, double t) const
+    {
+        if (t - last_refresh_ > min_time_per_update_) return true;
+        // An indeterminate bar stays at 0, which mustn't mean "always".
+        return !indeterminate_ && (progress == 0 || progress == 1);
+    }
+
+    bool time_to_log(double progress, double t)
+    {
+        if (progress == 1 && !indeterminate_) return !logged_done_;
+        if (next_log_progress_ == 0) return true; // nothing printed yet
+        if (log_interval_ > 0 && t - last_refresh_ >= log_interval_)
+            return true;
+        return log_progress_step_ > 0 && !indeterminate_ &&
+          progress >= next_log_progress_;
+    }
+
+    // Called after a log line is printed.
+    void advance_log_progress(double progress)
+    {
+        if (progress == 1 && !indeterminate_) logged_done_ = true;
+        double step = log_progress_step_ > 0 ? log_progress_step_ : 1;
+        next_log_progress_ = (std::floor(progress/step) + 1)*step;
+    }
+
+    void adapt_miniters(double t)
+    {
+        double dt = t - last_check_;
+        double iters = std::max<index>(iters_since_check_, 1);
+        last_check_ = t;
+        iters_checked_ += iters_since_check_;
+        iters_since_check_ = 0;
+
+        if (!dynamic_miniters_) return;
+
+        // Aim for checks_per_refresh_ time checks per refresh interval. Grow
+        // at most 2x per check so one fast burst can't make us go blind, but
+        // shrink immediately when iterations get slower.
+        double target = 2.0*miniters_;
+        if (dt > 0)
+        {
+            double rate = iters/dt;
+            target = std::min(target,
+                              rate*min_time_per_update_/checks_per_refresh_);
+        }
+        clamp(target, 1, max_miniters_);
+        miniters_ = static_cast<index>(target);
+    }
+
+    void display(double progress, double t)
+    {
+        update_rates(progress, t);
+        double eta = seconds_left(progress);
+
+        bool log = logging();
+
+        line_.clear();
+        if (!log) line_.append('\r');
+        line_.append(prefix_);
+        if (!indeterminate_)
+        {
+            line_.append('{');
+            line_.append_fixed(100*progress, 1, 5);
+            line_.append("%} ");
+            print_bar(progress);
+        }
+
+        if (scale_ != unit_scale::none && count_ >= 0)
+        {
+            if (!indeterminate_) line_.append(' ');
+            append_amount(count_);
+            if (total_ >= 0 && !indeterminate_)
+            {
+                line_.append(" / ");
+                append_amount(total_);
+            }
+        }
+        else if (indeterminate_ && count_ >= 0)
+        {
+            // without a percentage, at least show how many
+            line_.append_fixed(count_, 0);
+            line_.append(' ');
+            line_.append(unit_);
+        }
+
+        line_.append(" (");
+        line_.append_fixed(t, 1);
+        line_.append('s');
+        if (!indeterminate_)
+        {
+            line_.append(" < ");
+            if (std::isfinite(eta))
+            {
+                line_.append_fixed(eta, 1);
+                line_.append('s');
+            }
+            else
+            {
+                line_.append('?'); // no rate measured yet
+            }
+        }
+        if (count_ >= 0) append_rate(rates_.iters_per_sec);
+        if (latency_ && latency_->count() > 0) append_latency();
+        line_.append(") ");
+
+        suffix_.seekg(0);
+        line_.append(*suffix_.rdbuf());
+        append_lazy_suffix();
+
+        if (log)
+        {
+            // Bars don't share rows in a log, so the registry isn't involved.
+            line_.append('\n');
+            os_->write(line_.data(), line_.size());
+            os_->flush();
+            advance_log_progress(progress);
+            return;
+        }
+
+        index out_size = line_.size();
+        term_cols_ = std::max(term_cols_, out_size);
+        line_.append_n(' ', term_cols_ - out_size);
+
+        bar_registry::instance().draw(*os_, id_, line_.view());
+    }
+
+    // The ETA. Not finite while no rate has been measured yet, unless the
+    // work is already done (then the last sample may not have moved at all).
+    double seconds_left(double progress) const
+    {
+        if (progress >= 1) return 0;
+        return (1 - progress)/rates_.progress_per_sec;
+    }
+
+    // Only called on refreshes, so it costs nothing on the hot path.
+    void update_rates(double progress, double t)
+    {
+        index count = std::max<index>(count_, 0);
+        double dt = t - rates_.last_time;
+        if (smoothing_ == 0 && t > 0)
+        {
+            rates_.progress_per_sec = progress/t;
+            rates_.iters_per_sec = count/t;
+        }
+        else if (rates_.last_time == 0)
+        {
+            // The first refresh usually comes right after the first
+            // iteration, far too soon to measure anything: it only sets the
+            // starting point of the first sample.
+        }
+        else if (dt > 0)
+        {
+            double alpha = rates_.num_samples == 0 ? 1.0 : smoothing_;
+            double p = (progress - rates_.last_progress)/dt;
+            double c = (count - rates_.last_count)/dt;
+            rates_.progress_per_sec =
+              alpha*p + (1 - alpha)*rates_.progress_per_sec;
+            rates_.iters_per_sec = alpha*c + (1 - alpha)*rates_.iters_per_sec;
+            ++rates_.num_samples;
+        }
+        rates_.last_time = t;
+        rates_.last_progress = progress;
+        rates_.last_count = count;
+    }
+
+    // Like python's tqdm: it/s when fast, s/it when slow.
+    void append_rate(double iters_per_sec)
+    {
+        line_.append(", ");
+        if (scale_ != unit_scale::none)
+        {
+            append_amount(iters_per_sec);
+            line_.append("/s");
+        }
+        else if (iters_per_sec >= 1 || iters_per_sec == 0)
+        {
+            line_.append_fixed(iters_per_sec, 2);
+            line_.append(unit_);
+            line_.append("/s");
+        }
+        else
+        {
+            line_.append_fixed(1/iters_per_sec, 2);
+            line_.append("s/");
+            line_.append(unit_);
+        }
+    }
+
+    // e.g. ", p50 1.20us, p99 35.00us, max 2.10ms"
+    void append_latency()
+    {
+        line_.append(", p50 ");
+        append_duration(latency_->percentile(0.5));
+        line_.append(", p99 ");
+        append_duration(latency_->percentile(0.99));
+        line_.append(", max ");
+        append_duration(latency_->max());
+    }
+
+    void append_duration(latency_histogram::nanoseconds ns)
+    {
+        static constexpr std::array<std::string_view, 4> units = {
+          "ns", "us", "ms", "s"};
+        double x = ns;
+        std::size_t i = 0;
+        while (x >= 1000 && i + 1 < units.size())
+        {
+            x /= 1000;
+            ++i;
+        }
+        line_.append_fixed(x, i == 0 ? 0 : 2);
+        line_.append(units[i]);
+    }
+
+    // e.g. "1.50 GB" (si) or "1.40 GiB" (iec)
+    void append_amount(double x)
+    {
+        static constexpr std::array<std::string_view, 7> si = {
+          "", "k", "M", "G", "T", "P", "E"};
+        static constexpr std::array<std::string_view, 7> iec = {
+          "", "Ki", "Mi", "Gi", "Ti", "Pi", "Ei"};
+
+        double base = (scale_ == unit_scale::iec) ? 1024 : 1000;
+        std::size_t i = 0;
+        while (std::abs(x) >= base && i + 1 < si.size())
+        {
+            x /= base;
+            ++i;
+        }
+        line_.append_fixed(x, 2);
+        line_.append(' ');
+        line_.append(scale_ == unit_scale::iec ? iec[i] : si[i]);
+        line_.append(unit_);
+    }
+
+    void append_lazy_suffix()
+    {
+        if (watched_.empty() && !postfix_) return;
+
+        lazy_suffix_.str("");
+        for (auto& w : watched_) w(lazy_suffix_);
+        if (postfix_) postfix_(lazy_suffix_);
+        line_.append(*lazy_suffix_.rdbuf());
+    }
+
+    void print_bar(double filled)
+    {
+        auto num_filled = static_cast<index>(std::round(filled*bar_size_));
+        line_.append('[');
+        line_.append_n('#', num_filled);
+        line_.append_n(' ', bar_size_ - num_filled);
+        line_.append(']');
+    }
+
+    Chronometer chronometer_{};
+    double last_refresh_{0};
+    double min_time_per_update_{0.15}; // found experimentally
+
+    struct rates
+    {
+        double progress_per_sec{0};
+        double iters_per_sec{0};
+        double last_time{0};
+        double last_progress{0};
+        index last_count{0};
+        index num_samples{0};
+    };
+
+    index count_{-1};
+    index total_{-1};
+    const latency_histogram* latency_{nullptr};
+    bool indeterminate_{false};
+    std::string unit_{"it"};
+    unit_scale scale_{unit_scale::none};
+    rates rates_{};
+    double smoothing_{0.3}; // same default as python's tqdm
+
+    double last_check_{0};
+    index iters_since_check_{0};
+    index iters_checked_{0}; // before the last check
+    index miniters_{1};
+    bool dynamic_miniters_{true};
+    static constexpr double checks_per_refresh_{200};
+    static constexpr double max_miniters_{1e7};
+
+    std::ostream* os_{&std::cerr};
+    bool os_is_terminal_{is_terminal(std::cerr)};
+    output_mode mode_{output_mode::automatic};
+
+    double log_interval_{30};
+    double log_progress_step_{0.1};
+    double next_log_progress_{0}; // 0 until the first line is printed
+    bool logged_done_{false};
+
+    std::FILE* json_{nullptr};
+    bool json_owned_{false};
+    double json_interval_{1};
+    double last_json_{-1}; // -1 until the first line is written
+    bool json_done_{false};
+    line_buffer json_line_{};
+
+    shared_progress shared_{};
+
+    index bar_size_{40};
+    index term_cols_{1};
+
+    std::string prefix_{};
+    std::stringstream suffix_{};
+    bool suffix_stale_{false};  // set by update(), for bars without checks
+    index suffix_iteration_{0}; // iteration of the last write to suffix_
+
+    using printer = std::function<void(std::ostream&)>;
+    printer postfix_{};
+    std::vector<printer> watched_{};
+    std::stringstream lazy_suffix_{};
+
+    line_buffer line_{};
+    index id_{bar_registry::instance().next_id()};
+};
+
+#else // TQDM_DISABLE
+
+// Every bar draws through a progress_bar, so making this one empty turns
+// them all into no-ops, including classes constructed directly: no clock,
+// no buffers, no streams, no output.
+class progress_bar
+{
+public:
+    progress_bar() = default;
+    progress_bar(const progress_bar&) = delete;
+    progress_bar(progress_bar&&) = delete;
+    progress_bar& operator=(progress_bar&&) = delete;
+    progress_bar& operator=(const progress_bar&) = delete;
+    ~progress_bar() = default;
+
+    void restart() {}
+    bool skip_check() { return true; }
+    void update(double, index = -1) {}
+    void redraw(double, index = -1) {}
+    void set_ostream(std::ostream&) {}
+    void set_output_mode(output_mode) {}
+    void set_json_output(std::FILE*, double = 1) {}
+    void set_json_output(const std::string&, double = 1) {}
+    void set_shared_export(bool = true) {}
+    void set_log_interval(double, double = 0.1) {}
+    void set_prefix(std::string) {}
+    void set_bar_size(int) {}
+    void set_min_update_time(double) {}
+    void set_smoothing(double) {}
+    void set_unit(std::string, unit_scale = unit_scale::none) {}
+    void show_latency(const latency_histogram*) {}
+    void set_total(index) {}
+    void set_indeterminate(bool = true) {}
+    void set_miniters(index) {}
+
+    template <class T>
+    progress_bar& operator<<(const T&)
+    {
+        return *this;
+    }
+
+    template <class F>
+    void set_postfix(F)
+    {}
+
+    template <class T>
+    void watch(std::string, const T&)
+    {}
+
+    template <class T>
+    void watch(std::string, const T&&) = delete;
+
+    void clear_postfix() {}
+
+    double elapsed_time() const { return 0; }
+    double min_update_time() const { return 1; }
+    bool logging() const { return false; }
+};
+
+static_assert(std::is_empty_v<progress_bar>);
+
+#endif // TQDM_DISABLE
+
+// -------------------- background_renderer --------------------
+
+// One thread per process that periodically renders every registered bar, so
+// the loops themselves only have to bump a counter. The thread is started
+// when the first bar is added and stops when the last one is removed.
+//
+// Renders happen with mutex_ held, so after remove() returns the bar is
+// guaranteed not to be rendered again and can be safely destroyed.
+class background_renderer
+{
+public:
+    static background_renderer& instance()
+    {
+        static background_renderer renderer;
+        return renderer;
+    }
+
+    background_renderer(const background_renderer&) = delete;
+    background_renderer(background_renderer&&) = delete;
+    background_renderer& operator=(background_renderer&&) = delete;
+    background_renderer& operator=(const background_renderer&) = delete;
+
+    ~background_renderer()
+    {
+        std::unique_lock lock(mutex_);
+        jobs_.clear();
+        stop(lock);
+    }
+
+    // Calls render every `interval` seconds (or more often, if some other bar
+    // asks for a shorter interval) until remove(owner) is called.
+    void add(const void* owner, std::function<void()> render, double interval)
+    {
+        if constexpr (!enabled) return; // never start the thread
+        std::unique_lock lock(mutex_);
+        jobs_.push_back({owner, std::move(render), interval});
+        if (!thread_.joinable())
+            thread_ = std::thread(&background_renderer::run, this, generation_);
+        cv_.notify_all();
+    }
+
+    void remove(const void* owner)
+    {
+        std::unique_lock lock(mutex_);
+        jobs_.erase(std::remove_if(jobs_.begin(),
+                                   jobs_.end(),
+                                   [owner](const job& j) {
+                                       return j.owner == owner;
+                                   }),
+                    jobs_.end());
+        if (jobs_.empty()) stop(lock);
+    }
+
+private:
+    background_renderer() = default;
+
+    struct job
+    {
+        const void* owner;
+        std::function<void()> render;
+        double interval;
+    };
+
+    void run(index generation)
+    {
+        std::unique_lock lock(mutex_);
+        while (generation == generation_)
+        {
+            double interval = 1.0;
+            for (auto& j : jobs_)
+            {
+                j.render();
+                interval = std::min(interval, j.interval);
+            }
+            cv_.wait_for(lock, std::chrono::duration<double>(interval));
+        }
+    }
+
+    void stop(std::unique_lock<std::mutex>& lock)
+    {
+        ++generation_;
+        cv_.notify_all();
+        auto thread = std::move(thread_);
+        lock.unlock();
+        if (thread.joinable()) thread.join();
+    }
+
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::vector<job> jobs_;
+    index generation_{0};
+    std::thread thread_;
+};
+
+// -------------------- prometheus --------------------
+
+// Writes bars in the Prometheus text exposition format, e.g.
+//   tqdm_iterations{pid="42",bar="0",label="train"} 120
+// Each bar gets tqdm_iterations, tqdm_iterations_total (if the total is
+// known), tqdm_progress_ratio, tqdm_rate_per_second and
+// tqdm_elapsed_seconds, all gauges since a bar can be restarted. Counts are
+// written as integers and the rest with all 17 significant digits, so
+// nothing is rounded away before rate() or increase() see it.
+inline void write_prometheus(std::ostream& os,
+                             const std::vector<shared_snapshot>& bars)
+{
+    // Exactly one of count and real is set.
+    struct metric
+    {
+        const char* name;
+        const char* help;
+        std::int64_t shared_snapshot::*count;
+        double shared_snapshot::*real;
+    };
+    static constexpr std::array<metric, 5> metrics = {{
+      {"tqdm_iterations",
+       "Iterations done so far.",
+       &shared_snapshot::n,
+       nullptr},
+      {"tqdm_iterations_total",
+       "Iterations expected in total.",
+       &shared_snapshot::total,
+       nullptr},
+      {"tqdm_progress_ratio",
+       "Fraction of the work done, between 0 and 1.",
+       nullptr,
+       &shared_snapshot::progress},
+      {"tqdm_rate_per_second",
+       "Smoothed iterations per second.",
+       nullptr,
+       &shared_snapshot::rate},
+      {"tqdm_elapsed_seconds",
+       "Seconds since the bar started.",
+       nullptr,
+       &shared_snapshot::elapsed},
+    }};
+
+    auto write_label = [&os](std::string_view s) {
+        for (char c : s)
+        {
+            if (c == '\\' || c == '"') os << '\\';
+            if (c == '\n')
+                os << "\\n";
+            else
+                os << c;
+        }
+    };
+
+    for (const auto& m : metrics)
+    {
+        os << "# HELP " << m.name << ' ' << m.help << '\n';
+        os << "# TYPE " << m.name << " gauge\n";
+        for (const auto& bar : bars)
+        {
+            std::array<char, 32> value;
+            if (m.count)
+            {
+                if (bar.*m.count < 0) continue; // unknown
+                auto res = std::to_chars(
+                  value.data(), value.data() + value.size() - 1, bar.*m.count);
+                *res.ptr = '\0';
+            }
+            else
+            {
+                double x = bar.*m.real;
+                if (x < 0 || !std::isfinite(x)) continue; // unknown
+                std::snprintf(value.data(), value.size(), "%.17g", x);
+            }
+            os << m.name << "{pid=\"" << bar.pid << "\",bar=\"" << bar.id
+               << "\",label=\"";
+            write_label(bar.label);
+            os << "\"} " << value.data() << '\n';
+        }
+    }
+}
+
+#ifdef TQDM_HAS_MMAP
+// Periodically writes the bars of this process that have
+// set_shared_export() on to a file, for node_exporter's textfile collector.
+// The file is replaced atomically (written next to it, then renamed), and
+// the work happens on the background_renderer thread, so the loops being
+// watched don't do anything more than they do for set_shared_export().
+class prometheus_exporter
+{
+public:
+    explicit prometheus_exporter(std::string path, double interval = 15)
+        : path_(std::move(path)), interval_(interval)
+    {
+        write();
+        background_renderer::instance().add(
+          this, [this]() { write_if_due(); }, interval_);
+    }
+
+    prometheus_exporter(const prometheus_exporter&) = delete;
+    prometheus_exporter(prometheus_exporter&&) = delete;
+    prometheus_exporter& operator=(prometheus_exporter&&) = delete;
+    prometheus_exporter& operator=(const prometheus_exporter&) = delete;
+    ~prometheus_exporter()
+    {
+        background_renderer::instance().remove(this);
+        write(); // final state
+    }
+
+    // Writes the file right away.
+    void write()
+    {
+        std::lock_guard lock(mutex_);
+        write_file();
+    }
+
+private:
+    // The renderer runs every job at the shortest interval any job asked for.
+    void write_if_due()
+    {
+        std::lock_guard lock(mutex_);
+        if (last_write_.peek() >= interval_) write_file();
+    }
+
+    // A failed write (e.g. a full disk) leaves the previous file in place.
+    void write_file()
+    {
+        auto tmp = path_ + ".tmp";
+        std::ofstream out(tmp);
+        write_prometheus(out, shared_bars(getpid()));
+        out.close();
+        std::error_code ec;
+        if (out)
+            std::filesystem::rename(tmp, path_, ec);
+        else
+            std::filesystem::remove(tmp, ec);
+        last_write_.reset();
+    }
+
+    std::string path_;
+    double interval_;
+    Chronometer last_write_{};
+    std::mutex mutex_;
+};
+#endif
+
+// -------------------- iter_wrapper --------------------
+
+template <class ForwardIter, class Parent>
+class iter_wrapper
+{
+public:
+    using traits = std::iterator_traits<ForwardIter>;
+    using iterator_category = typename traits::iterator_category;
+    using value_type = typename traits::value_type;
+    using difference_type = typename traits::difference_type;
+    using pointer = typename traits::pointer;
+    using reference = typename traits::reference;
+#if __cpp_lib_ranges >= 201911L
+    using iterator_concept =
+      std::conditional_t<std::contiguous_iterator<ForwardIter>,
+                         std::contiguous_iterator_tag,
+                         iterator_category>;
+#endif
+
+    iter_wrapper() = default;
+
+    iter_wrapper(ForwardIter it, Parent* parent) : current_(it), parent_(parent)
+    {}
+
+    // reference and not auto, so that elements aren't copied and can be
+    // modified through the wrapper (proxies like vector<bool>'s work too).
+    reference operator*() const { return *current_; }
+
+    pointer operator->() const
+    {
+        if constexpr (std::is_pointer_v<ForwardIter>)
+            return current_;
+        else
+            return current_.operator->();
+    }
+
+    // Progress is counted when moving forward, not when comparing, so a
+    // loop over n elements counts exactly n, and algorithms that compare
+    // iterators a lot (like sort) don't inflate the count.
+    iter_wrapper& operator++()
+    {
+        ++current_;
+        parent_->update();
+        return *this;
+    }
+
+    iter_wrapper operator++(int)
+    {
+        auto old = *this;
+        ++*this;
+        return old;
+    }
+
+    template <class Other>
+    bool operator!=(const Other& other) const
+    {
+        return current_ != other;
+    }
+
+    bool operator!=(const iter_wrapper& other) const
+    {
+        return current_ != other.current_;
+    }
+
+    bool operator==(const iter_wrapper& other) const
+    {
+        return current_ == other.current_;
+    }
+
+    // The rest is only usable when ForwardIter supports it, and lets tqdm
+    // wrap algorithms that need bidirectional or random access iterators.
+    // Jumping forward with += counts as progress; building a new iterator
+    // with + doesn't, since algorithms do that to split or probe the range.
+    // Counting isn't thread-safe: don't pass these iterators to algorithms
+    // with a parallel execution policy (use parallel_for, or
+    // concurrent_progress, instead).
+
+    iter_wrapper& operator--()
+    {
+        --current_;
+        return *this;
+    }
+
+    iter_wrapper operator--(int)
+    {
+        auto old = *this;
+        --current_;
+        return old;
+    }
+
+    iter_wrapper& operator+=(difference_type n)
+    {
+        current_ += n;
+        if (n > 0) parent_->advance(n);
+        return *this;
+    }
+
+    iter_wrapper& operator-=(difference_type n)
+    {
+        current_ -= n;
+        if (n < 0) parent_->advance(-n);
+        return *this;
+    }
+
+    iter_wrapper operator+(difference_type n) const
+    {
+        return iter_wrapper(current_ + n, parent_);
+    }
+
+    friend iter_wrapper operator+(difference_type n, const iter_wrapper& it)
+    {
+        return it + n;
+    }
+
+    iter_wrapper operator-(difference_type n) const
+    {
+        return iter_wrapper(current_ - n, parent_);
+    }
+
+    difference_type operator-(const iter_wrapper& other) const
+    {
+        return current_ - other.current_;
+    }
+
+    reference operator[](difference_type n) const { return current_[n]; }
+
+    bool operator<(const iter_wrapper& other) const
+    {
+        return current_ < other.current_;
+    }
+    bool operator>(const iter_wrapper& other) const
+    {
+        return current_ > other.current_;
+    }
+    bool operator<=(const iter_wrapper& other) const
+    {
+        return current_ <= other.current_;
+    }
+    bool operator>=(const iter_wrapper& other) const
+    {
+        return current_ >= other.current_;
+    }
+
+    [[nodiscard]] const ForwardIter& get() const { return current_; }
+
+private:
+    friend Parent;
+    ForwardIter current_{};
+    Parent* parent_{nullptr};
+};
+
+// -------------------- tqdm_for_lvalues --------------------
+
+template <class ForwardIter, class EndIter = ForwardIter>
+class tqdm_for_lvalues
+{
+public:
+    using this_t = tqdm_for_lvalues<ForwardIter, EndIter>;
+    using iterator = iter_wrapper<ForwardIter, this_t>;
+    using value_type = typename std::iterator_traits<ForwardIter>::value_type;
+    using size_type = index;
+    using difference_type = index;
+
+    tqdm_for_lvalues(ForwardIter begin, EndIter end)
+        : first_(begin, this), last_(end), num_iters_(std::distance(begin, end))
+    {}
+
+    tqdm_for_lvalues(ForwardIter begin, EndIter end, index total)
+        : first_(begin, this), last_(end), num_iters_(total)
+    {
+        bar_.set_total(num_iters_);
+    }
+
+    template <class Container>
+    explicit tqdm_for_lvalues(Container& C)
+        : first_(C.begin(), this), last_(C.end()), num_iters_(C.size())
+    {
+        bar_.set_total(num_iters_);
+    }
+
+    template <class Container>
+    explicit tqdm_for_lvalues(const Container& C)
+        : first_(C.begin(), this), last_(C.end()), num_iters_(C.size())
+    {
+        bar_.set_total(num_iters_);
+    }
+
+    tqdm_for_lvalues(const tqdm_for_lvalues&) = delete;
+    tqdm_for_lvalues(tqdm_for_lvalues&&) = delete;
+    tqdm_for_lvalues& operator=(tqdm_for_lvalues&&) = delete;
+    tqdm_for_lvalues& operator=(const tqdm_for_lvalues&) = delete;
+    ~tqdm_for_lvalues()
+    {
+        // show where the loop stopped, if it didn't reach the end
+        if (!in_background_) return;
+        stop_background();
+        bar_.redraw(calc_progress(), iters_done());
+    }
+
+    template <class Container>
+    tqdm_for_lvalues(Container&&) = delete; // prevent misuse!
+
+    iterator begin()
+    {
+        stop_background();
+        bar_.restart();
+        iters_done_ = 0;
+        if (latency_) latency_->clear();
+        last_tick_ = latency_ ? tsc_clock_policy::now() : 0;
+        // nothing will be counted, so show the (complete) bar right away
+        if (num_iters_ == 0) bar_.redraw(1, 0);
+        if (background_) start_background();
+        return first_;
+    }
+
+    // When both ends have the same type, return a wrapper too, so that
+    // begin() and end() can be passed to standard algorithms.
+    auto end()
+    {
+        if constexpr (std::is_same_v<ForwardIter, EndIter>)
+            return iterator(last_, this);
+        else
+            return last_;
+    }
+
+    void update() { advance(1); }
+
+    void advance(index amount)
+    {
+        if constexpr (!enabled) return;
+        if (latency_) record_tick(amount);
+
+        index done = iters_done_.load(std::memory_order_relaxed);
+        iters_done_.store(done + amount, std::memory_order_relaxed);
+
+        // always display the last iteration, so the bar ends at 100%
+        bool finishing = done <= num_iters_ && done + amount >= num_iters_;
+        if (!finishing && (background_ || bar_.skip_check())) return;
+
+        stop_background();
+        bar_.update(calc_progress(), iters_done());
+    }
+
+    // Render from the background_renderer thread instead of the loop, which
+    // then only increments a counter. Call before iterating. The suffix
+    // written with << is not synchronized with the renderer; use watch()
+    // or set_postfix() instead.
+    void render_in_background(bool on = true) { background_ = on; }
+
+    // Time every iteration into a latency_histogram, and show its p50, p99
+    // and max on the bar. Costs a read of the cycle counter (see
+    // tsc_clock_policy) per iteration. Call before iterating.
+    void record_latency(bool on = true)
+    {
+        if (on && !latency_) latency_ = std::make_unique<latency_histogram>();
+        if (!on) latency_.reset();
+        bar_.show_latency(latency_.get());
+    }
+
+    // Only valid after record_latency(), e.g. latency().print(std::cerr) to
+    // dump the whole histogram after the loop.
+    const latency_histogram& latency() const { return *latency_; }
+
+    void set_ostream(std::ostream& os) { bar_.set_ostream(os); }
+    void set_prefix(std::string s) { bar_.set_prefix(std::move(s)); }
+    void set_bar_size(int size) { bar_.set_bar_size(size); }
+    void set_min_update_time(double time) { bar_.set_min_update_time(time); }
+    void set_output_mode(output_mode mode) { bar_.set_output_mode(mode); }
+    void set_log_interval(double seconds, double progress_step = 0.1)
+    {
+        bar_.set_log_interval(seconds, progress_step);
+    }
+    void set_json_output(std::FILE* f, double interval = 1)
+    {
+        bar_.set_json_output(f, interval);
+    }
+    void set_json_output(const std::string& path, double interval = 1)
+    {
+        bar_.set_json_output(path, interval);
+    }
+    void set_shared_export(bool on = true) { bar_.set_shared_export(on); }
+    void set_smoothing(double alpha) { bar_.set_smoothing(alpha); }
+    void set_unit(std::string unit, unit_scale scale = unit_scale::none)
+    {
+        bar_.set_unit(std::move(unit), scale);
+    }
+    void set_miniters(index n) { bar_.set_miniters(n); }
+
+    template <class T>
+    tqdm_for_lvalues& operator<<(const T& t)
+    {
+        bar_ << t;
+        return *this;
+    }
+
+    template <class F>
+    void set_postfix(F f)
+    {
+        bar_.set_postfix(std::move(f));
+    }
+
+    template <class T>
+    void watch(std::string name, const T& value)
+    {
+        bar_.watch(std::move(name), value);
+    }
+
+    template <class T>
+    void watch(std::string name, const T&& value) = delete;
+
+    void clear_postfix() { bar_.clear_postfix(); }
+
+    void manually_set_progress(double to)
+    {
+        clamp(to, 0, 1);
+        iters_done_ = static_cast<index>(std::round(to*num_iters_));
+    }
+
+private:
+    index iters_done() const
+    {
+        return iters_done_.load(std::memory_order_relaxed);
+    }
+
+    double calc_progress() const
+    {
+        double denominator = num_iters_;
+        if (num_iters_ == 0) denominator += 1e-9;
+        return iters_done()/denominator;
+    }
+
+    // Called after each iteration (begin() starts the clock); jumps of
+    // several iterations count as that many equal ones.
+    void record_tick(index amount)
+    {
+        auto now = tsc_clock_policy::now();
+        if (last_tick_ != 0 && amount > 0)
+        {
+            double ns = 1e9*tsc_clock_policy::seconds(last_tick_, now);
+            latency_->record(static_cast<std::uint64_t>(ns/amount), amount);
+        }
+        last_tick_ = now;
+    }
+
+    void start_background()
+    {
+        background_renderer::instance().add(
+          this,
+          [this]() { bar_.update(calc_progress(), iters_done()); },
+          bar_.min_update_time());
+        in_background_ = true;
+    }
+
+    void stop_background()
+    {
+        if (!in_background_) return;
+        background_renderer::instance().remove(this);
+        in_background_ = false;
+    }
+
+    iterator first_;
+    EndIter last_;
+    index num_iters_{0};
+    // atomic so the background renderer can read it; only the loop writes
+    std::atomic<index> iters_done_{0};
+    bool background_{false};
+    bool in_background_{false};
+    std::unique_ptr<latency_histogram> latency_{};
+    tsc_clock_policy::time_point last_tick_{0};
+    progress_bar bar_;
+};
+
+template <class Container>
+tqdm_for_lvalues(Container&) -> tqdm_for_lvalues<typename Container::iterator>;
+
+template <class Container>
+tqdm_for_lvalues(const Container&)
+  -> tqdm_for_lvalues<typename Container::const_iterator>;
+
+// -------------------- tqdm_for_rvalues --------------------
+
+template <class Container>
+class tqdm_for_rvalues
+{
+public:
+    using iterator = typename Container::iterator;
+    using const_iterator = typename Container::const_iterator;
+    using value_type = typename Container::value_type;
+
+    explicit tqdm_for_rvalues(Container&& C)
+        : C_(std::forward<Container>(C)), tqdm_(C_)
+    {}
+
+    auto begin() { return tqdm_.begin(); }
+
+    auto end() { return tqdm_.end(); }
+
+    void update() { return tqdm_.update(); }
+
+    void set_ostream(std::ostream& os) { tqdm_.set_ostream(os); }
+    void set_prefix(std::string s) { tqdm_.set_prefix(std::move(s)); }
+    void set_bar_size(int size) { tqdm_.set_bar_size(size); }
+    void set_min_update_time(double time) { tqdm_.set_min_update_time(time); }
+    void set_output_mode(output_mode mode) { tqdm_.set_output_mode(mode); }
+    void set_log_interval(double seconds, double progress_step = 0.1)
+    {
+        tqdm_.set_log_interval(seconds, progress_step);
+    }
+    void set_json_output(std::FILE* f, double interval = 1)
+    {
+        tqdm_.set_json_output(f, interval);
+    }
+    void set_json_output(const std::string& path, double interval = 1)
+    {
+        tqdm_.set_json_output(path, interval);
+    }
+    void set_shared_export(bool on = true) { tqdm_.set_shared_export(on); }
+    void set_smoothing(double alpha) { tqdm_.set_smoothing(alpha); }
+    void set_unit(std::string unit, unit_scale scale = unit_scale::none)
+    {
+        tqdm_.set_unit(std::move(unit), scale);
+    }
+    void set_miniters(index n) { tqdm_.set_miniters(n); }
+
+    template <class T>
+    auto& operator<<(const T& t)
+    {
+        return tqdm_ << t;
+    }
+
+    template <class F>
+    void set_postfix(F f)
+    {
+        tqdm_.set_postfix(std::move(f));
+    }
+
+    template <class T>
+    void watch(std::string name, const T& value)
+    {
+        tqdm_.watch(std::move(name), value);
+    }
+
+    template <class T>
+    void watch(std::string name, const T&& value) = delete;
+
+    void clear_postfix() { tqdm_.clear_postfix(); }
+
+    void advance(index amount) { tqdm_.advance(amount); }
+
+    void manually_set_progress(double to) { tqdm_.manually_set_progress(to); }
+    void render_in_background(bool on = true)
+    {
+        tqdm_.render_in_background(on);
+    }
+    void record_latency(bool on = true) { tqdm_.record_latency(on); }
+    const latency_histogram& latency() const { return tqdm_.latency(); }
+
+private:
+    Container C_;
+    tqdm_for_lvalues<iterator> tqdm_;
+};
+
+template <class Container>
+tqdm_for_rvalues(Container &&) -> tqdm_for_rvalues<Container>;
+
+// -------------------- passthrough --------------------
+
+// What tqdm() returns when TQDM_DISABLE is defined: it iterates exactly like
+// the wrapped range (with the very same iterators) and ignores everything
+// else, so loops compile to the same code as if tqdm wasn't there.
+// Range is a reference type for lvalues and a value type for rvalues.
+template <class Range>
+class passthrough
+{
+public:
+    explicit passthrough(Range r) : r_(std::forward<Range>(r)) {}
+
+    auto begin() { return r_.begin(); }
+    auto end() { return r_.end(); }
+
+    void update() {}
+    void advance(index) {}
+
+    void set_ostream(std::ostream&) {}
+    void set_prefix(const std::string&) {}
+    void set_bar_size(int) {}
+    void set_min_update_time(double) {}
+    void set_output_mode(output_mode) {}
+    void set_log_interval(double, double = 0.1) {}
+    void set_json_output(std::FILE*, double = 1) {}
+    void set_json_output(const std::string&, double = 1) {}
+    void set_shared_export(bool = true) {}
+    void set_smoothing(double) {}
+    void set_unit(const std::string&, unit_scale = unit_scale::none) {}
+    void set_miniters(index) {}
+    void render_in_background(bool = true) {}
+    void record_latency(bool = true) {}
+    void manually_set_progress(double) {}
+
+    // Nothing is ever recorded.
+    const latency_histogram& latency() const
+    {
+        static const latency_histogram empty;
+        return empty;
+    }
+
+    template <class T>
+    passthrough& operator<<(const T&)
+    {
+        return *this;
+    }
+
+    template <class F>
+    void set_postfix(F)
+    {}
+
+    template <class T>
+    void watch(const std::string&, const T&)
+    {}
+
+    void clear_postfix() {}
+
+private:
+    Range r_;
+};
+
+template <class ForwardIter>
+struct iterator_range
+{
+    ForwardIter first;
+    ForwardIter last;
+
+    ForwardIter begin() const { return first; }
+    ForwardIter end() const { return last; }
+    index size() const { return std::distance(first, last); }
+};
+
+// -------------------- tqdm --------------------
+#ifdef TQDM_DISABLE
+
+template <class ForwardIter>
+auto tqdm(const ForwardIter& first, const ForwardIter& last)
+{
+    return passthrough<iterator_range<ForwardIter>>({first, last});
+}
+
+template <class ForwardIter>
+auto tqdm(const ForwardIter& first, const ForwardIter& last, index)
+{
+    return passthrough<iterator_range<ForwardIter>>({first, last});
+}
+
+template <class Container>
+auto tqdm(const Container& C)
+{
+    return passthrough<const Container&>(C);
+}
+
+template <class Container>
+auto tqdm(Container& C)
+{
+    return passthrough<Container&>(C);
+}
+
+template <class Container>
+auto tqdm(Container&& C)
+{
+    return passthrough<Container>(std::forward<Container>(C));
+}
+
+#else
+
+template <class ForwardIter>
+auto tqdm(const ForwardIter& first, const ForwardIter& last)
+{
+    return tqdm_for_lvalues(first, last);
+}
+
+template <class ForwardIter>
+auto tqdm(const ForwardIter& first, const ForwardIter& last, index total)
+{
+    return tqdm_for_lvalues(first, last, total);
+}
+
+template <class Container>
+auto tqdm(const Container& C)
+{
+    return tqdm_for_lvalues(C);
+}
+
+template <class Container>
+auto tqdm(Container& C)
+{
+    return tqdm_for_lvalues(C);
+}
+
+template <class Container>
+auto tqdm(Container&& C)
+{
+    return tqdm_for_rvalues(std::forward<Container>(C));
+}
+
+#endif // TQDM_DISABLE
+
+// -------------------- int_iterator --------------------
+
+template <class IntType>
+class int_iterator
+{
+public:
+    using iterator_category = std::random_access_iterator_tag;
+    using value_type = IntType;
+    using difference_type = IntType;
+    using pointer = IntType*;
+    using reference = IntType; // values are computed, nothing to refer to
+
+    int_iterator() = default;
+    explicit int_iterator(IntType val) : value_(val) {}
+
+    IntType operator*() const { return value_; }
+    IntType operator[](difference_type d) const { return value_ + d; }
+
+    int_iterator& operator++()
+    {
+        ++value_;
+        return *this;
+    }
+    int_iterator& operator--()
+    {
+        --value_;
+        return *this;
+    }
+    int_iterator operator++(int) { return int_iterator(value_++); }
+    int_iterator operator--(int) { return int_iterator(value_--); }
+
+    int_iterator& operator+=(difference_type d)
+    {
+        value_ += d;
+        return *this;
+    }
+    int_iterator& operator-=(difference_type d)
+    {
+        value_ -= d;
+        return *this;
+    }
+
+    int_iterator operator+(difference_type d) const
+    {
+        return int_iterator(value_ + d);
+    }
+    friend int_iterator operator+(difference_type d, const int_iterator& it)
+    {
+        return it + d;
+    }
+    int_iterator operator-(difference_type d) const
+    {
+        return int_iterator(value_ - d);
+    }
+
+    difference_type operator-(const int_iterator& other) const
+    {
+        return value_ - other.value_;
+    }
+
+    bool operator!=(const int_iterator& other) const
+    {
+        return value_ != other.value_;
+    }
+    bool operator==(const int_iterator& other) const
+    {
+        return value_ == other.value_;
+    }
+    bool operator<(const int_iterator& other) const
+    {
+        return value_ < other.value_;
+    }
+    bool operator>(const int_iterator& other) const
+    {
+        return value_ > other.value_;
+    }
+    bool operator<=(const int_iterator& other) const
+    {
+        return value_ <= other.value_;
+    }
+    bool operator>=(const int_iterator& other) const
+    {
+        return value_ >= other.value_;
+    }
+
+private:
+    IntType value_{0};
+};
+
+// -------------------- range --------------------
+template <class IntType>
+class range
+{
+public:
+    using iterator = int_iterator<IntType>;
+    using const_iterator = iterator;
+    using value_type = IntType;
+
+    range(IntType first, IntType last) : first_(first), last_(last) {}
+    explicit range(IntType last) : first_(0), last_(last) {}
+
+    [[nodiscard]] iterator begin() const { return first_; }
+    [[nodiscard]] iterator end() const { return last_; }
+    [[nodiscard]] index size() const { return last_ - first_; }
+
+private:
+    iterator first_;
+    iterator last_;
+};
+
+template <class IntType>
+auto trange(IntType first, IntType last)
+{
+    return tqdm(range(first, last));
+}
+
+template <class IntType>
+auto trange(IntType last)
+{
+    return tqdm(range(last));
+}
+
+// -------------------- tqdm_chunks --------------------
+
+// Iterates over a range in chunks of chunk_size consecutive elements (the
+// last one may be shorter), updating the bar once per chunk instead of once
+// per element. The loop over a chunk is then a plain loop over the range's
+// own iterators, which the compiler is free to vectorize:
+//     for (auto chunk : tq::tqdm_chunks(A, 4096))
+//         for (float& x : chunk) x *= 2;
+// The bar counts elements, not chunks. Range is a reference type for lvalues
+// and a value type for rvalues. With TQDM_DISABLE it still yields chunks,
+// just without a bar.
+template <class Range>
+class tqdm_chunked
+{
+public:
+    using base_iterator = decltype(std::begin(std::declval<Range&>()));
+    using chunk = iterator_range<base_iterator>;
+
+    class iterator
+    {
+    public:
+        using iterator_category = std::input_iterator_tag;
+        using value_type = chunk;
+        using difference_type = index;
+        using pointer = void;
+        using reference = chunk;
+
+        iterator(base_iterator it, index remaining, tqdm_chunked* parent)
+            : it_(it), remaining_(remaining), parent_(parent)
+        {}
+
+        chunk operator*() const { return {it_, std::next(it_, step())}; }
+
+        iterator& operator++()
+        {
+            index n = step();
+            std::advance(it_, n);
+            remaining_ -= n;
+            return *this;
+        }
+
+        bool operator!=(const iterator& other) const
+        {
+            parent_->report(parent_->total_ - remaining_);
+            return remaining_ != other.remaining_;
+        }
+
+        bool operator==(const iterator& other) const
+        {
+            return !(*this != other);
+        }
+
+    private:
+        index step() const
+        {
+            return std::min(remaining_, parent_->chunk_size_);
+        }
+
+        base_iterator it_;
+        index remaining_;
+        tqdm_chunked* parent_;
+    };
+
+    tqdm_chunked(Range r, index chunk_size)
+        : r_(std::forward<Range>(r))
+        , chunk_size_(std::max<index>(chunk_size, 1))
+        , total_(std::distance(std::begin(r_), std::end(r_)))
+    {
+        bar_.set_total(total_);
+    }
+
+    tqdm_chunked(const tqdm_chunked&) = delete;
+    tqdm_chunked(tqdm_chunked&&) = delete;
+    tqdm_chunked& operator=(tqdm_chunked&&) = delete;
+    tqdm_chunked& operator=(const tqdm_chunked&) = delete;
+    ~tqdm_chunked() = default;
+
+    iterator begin()
+    {
+        bar_.restart();
+        return {std::begin(r_), total_, this};
+    }
+
+    iterator end() { return {std::end(r_), 0, this}; }
+
+    void set_ostream(std::ostream& os) { bar_.set_ostream(os); }
+    void set_prefix(std::string s) { bar_.set_prefix(std::move(s)); }
+    void set_bar_size(int size) { bar_.set_bar_size(size); }
+    void set_min_update_time(double time) { bar_.set_min_update_time(time); }
+    void set_output_mode(output_mode mode) { bar_.set_output_mode(mode); }
+    void set_log_interval(double seconds, double progress_step = 0.1)
+    {
+        bar_.set_log_interval(seconds, progress_step);
+    }
+    void set_json_output(std::FILE* f, double interval = 1)
+    {
+        bar_.set_json_output(f, interval);
+    }
+    void set_json_output(const std::string& path, double interval = 1)
+    {
+        bar_.set_json_output(path, interval);
+    }
+    void set_shared_export(bool on = true) { bar_.set_shared_export(on); }
+    void set_smoothing(double alpha) { bar_.set_smoothing(alpha); }
+    void set_unit(std::string unit, unit_scale scale = unit_scale::none)
+    {
+        bar_.set_unit(std::move(unit), scale);
+    }
+    void set_miniters(index n) { bar_.set_miniters(n); }
+
+    template <class T>
+    tqdm_chunked& operator<<(const T& t)
+    {
+        bar_ << t;
+        return *this;
+    }
+
+    template <class F>
+    void set_postfix(F f)
+    {
+        bar_.set_postfix(std::move(f));
+    }
+
+    template <class T>
+    void watch(std::string name, const T& value)
+    {
+        bar_.watch(std::move(name), value);
+    }
+
+    template <class T>
+    void watch(std::string name, const T&& value) = delete;
+
+    void clear_postfix() { bar_.clear_postfix(); }
+
+private:
+    void report(index done)
+    {
+        if constexpr (!enabled) return;
+        if (done != total_ && bar_.skip_check()) return;
+
+        bar_.update(total_ == 0 ? 1.0 : double(done)/total_, done);
+    }
+
+    Range r_;
+    index chunk_size_;
+    index total_;
+    progress_bar bar_;
+};
+
+template <class Container>
+auto tqdm_chunks(Container&& C, index chunk_size)
+{
+    return tqdm_chunked<Container>(std::forward<Container>(C), chunk_size);
+}
+
+// -------------------- progress_view --------------------
+#if __cpp_lib_ranges >= 201911L
+
+// A C++20 view that shows a bar while it's iterated, so tqdm composes with
+// other views, lazily:
+//     for (auto y : data | std::views::filter(f) | tq::progress("filtered ")
+//                        | std::views::transform(g))
+// The bar counts the elements that come through. If the base is sized, it
+// also shows the percentage and ETA; otherwise only the count and rate.
+// Copies of a view share one bar, and iterators point into it, so the view
+// isn't a borrowed range.
+template <std::ranges::view V>
+class progress_view : public std::ranges::view_interface<progress_view<V>>
+{
+    struct state
+    {
+        progress_bar bar;
+        index count{0};
+        index total{-1};
+        bool finished{false};
+
+        state(const state&) = delete;
+        state(state&&) = delete;
+        state& operator=(state&&) = delete;
+        state& operator=(const state&) = delete;
+        state() = default;
+
+        // A loop that didn't reach the end (or an unsized one, which can't
+        // know it did) is shown where it stopped.
+        ~state()
+        {
+            if (!finished && count > 0) bar.redraw(progress(), count);
+        }
+
+        double progress() const
+        {
+            if (total < 0) return 0;
+            return total == 0 ? 1.0 : double(count)/total;
+        }
+
+        void restart()
+        {
+            count = 0;
+            finished = false;
+            bar.restart();
+            bar.update(progress(), count);
+        }
+
+        void advance()
+        {
+            if constexpr (!enabled) return;
+            ++count;
+            if (count == total) finished = true;
+            else if (bar.skip_check()) return;
+            bar.update(progress(), count);
+        }
+    };
+
+    using base_iterator = std::ranges::iterator_t<V>;
+    using base_sentinel = std::ranges::sentinel_t<V>;
+
+    class sentinel;
+
+    class iterator
+    {
+    public:
+        using iterator_concept =
+          std::conditional_t<std::ranges::forward_range<V>,
+                             std::forward_iterator_tag,
+                             std::input_iterator_tag>;
+        using iterator_category = std::input_iterator_tag;
+        using value_type = std::ranges::range_value_t<V>;
+        using difference_type = std::ranges::range_difference_t<V>;
+
+        iterator() = default;
+        iterator(base_iterator it, state* s) : it_(std::move(it)), state_(s)
+        {}
+
+        decltype(auto) operator*() const { return *it_; }
+        const base_iterator& base() const { return it_; }
+
+        iterator& operator++()
+        {
+            ++it_;
+            state_->advance();
+            return *this;
+        }
+
+        void operator++(int) { ++*this; }
+
+        iterator operator++(int) requires std::ranges::forward_range<V>
+        {
+            auto copy = *this;
+            ++*this;
+            return copy;
+        }
+
+        friend bool operator==(const iterator& a, const iterator& b) requires
+          std::equality_comparable<base_iterator>
+        {
+            return a.it_ == b.it_;
+        }
+
+    private:
+        base_iterator it_{};
+        state* state_{nullptr};
+    };
+
+    class sentinel
+    {
+    public:
+        sentinel() = default;
+        explicit sentinel(base_sentinel end) : end_(std::move(end)) {}
+
+        friend bool operator==(const iterator& it, const sentinel& s)
+        {
+            return it.base() == s.end_;
+        }
+
+    private:
+        base_sentinel end_{};
+    };
+
+public:
+    progress_view() requires std::default_initializable<V> = default;
+
+    progress_view(V base, std::string prefix = {})
+        : base_(std::move(base)), state_(std::make_shared<state>())
+    {
+        state_->bar.set_prefix(std::move(prefix));
+        if constexpr (std::ranges::sized_range<V>)
+        {
+            state_->total = std::ranges::size(base_);
+            state_->bar.set_total(state_->total);
+        }
+        else
+        {
+            state_->bar.set_indeterminate();
+        }
+    }
+
+    V base() const& requires std::copy_constructible<V> { return base_; }
+    V base() && { return std::move(base_); }
+
+    iterator begin()
+    {
+        state_->restart();
+        return {std::ranges::begin(base_), state_.get()};
+    }
+
+    auto end()
+    {
+        if constexpr (std::ranges::common_range<V>)
+            return iterator(std::ranges::end(base_), state_.get());
+        else
+            return sentinel(std::ranges::end(base_));
+    }
+
+    auto size() requires std::ranges::sized_range<V>
+    {
+        return std::ranges::size(base_);
+    }
+
+    // For anything else: the bar's setters (set_ostream, set_unit...).
+    progress_bar& bar() { return state_->bar; }
+
+private:
+    V base_{};
+    std::shared_ptr<state> state_{};
+};
+
+template <class R>
+progress_view(R&&, std::string = {}) -> progress_view<std::views::all_t<R>>;
+
+// What tq::progress() returns: applied with |, it wraps the range on the
+// left in a progress_view (or, with TQDM_DISABLE, leaves it alone).
+struct progress_adaptor
+{
+    std::string prefix;
+
+    template <std::ranges::viewable_range R>
+    friend auto operator|(R&& r, progress_adaptor a)
+    {
+        if constexpr (enabled)
+            return progress_view(std::forward<R>(r), std::move(a.prefix));
+        else
+            return std::views::all(std::forward<R>(r));
+    }
+};
+
+inline progress_adaptor progress(std::string prefix = {})
+{
+    return {std::move(prefix)};
+}
+
+#endif // __cpp_lib_ranges
+
+// -------------------- timing_iterator --------------------
+
+class timing_iterator_end_sentinel
+{
+public:
+    explicit timing_iterator_end_sentinel(double num_seconds)
+        : num_seconds_(num_seconds)
+    {}
+
+    [[nodiscard]] double num_seconds() const { return num_seconds_; }
+
+private:
+    double num_seconds_;
+};
+
+class timing_iterator
+{
+public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = double;
+    using difference_type = double;
+    using pointer = double*;
+    using reference = double; // computed on the fly, nothing to refer to
+
+    double operator*() const { return chrono_.peek(); }
+
+    timing_iterator& operator++() { return *this; }
+
+    bool operator!=(const timing_iterator_end_sentinel& other) const
+    {
+        return chrono_.peek() < other.num_seconds();
+    }
+
+private:
+    tq::Chronometer chrono_;
+};
+
+// -------------------- timer -------------------
+struct timer
+{
+public:
+    using iterator = timing_iterator;
+    using end_iterator = timing_iterator_end_sentinel;
+    using const_iterator = iterator;
+    using value_type = double;
+
+    explicit timer(double num_seconds) : num_seconds_(num_seconds) {}
+
+    [[nodiscard]] static iterator begin() { return iterator(); }
+    [[nodiscard]] end_iterator end() const
+    {
+        return end_iterator(num_seconds_);
+    }
+
+    [[nodiscard]] double num_seconds() const { return num_seconds_; }
+
+private:
+    double num_seconds_;
+};
+
+class tqdm_timer
+{
+public:
+    using iterator = iter_wrapper<timing_iterator, tqdm_timer>;
+    using end_iterator = timer::end_iterator;
+    using value_type = typename timing_iterator::value_type;
+    using size_type = index;
+    using difference_type = index;
+
+    explicit tqdm_timer(double num_seconds) : num_seconds_(num_seconds) {}
+
+    tqdm_timer(const tqdm_timer&) = delete;
+    tqdm_timer(tqdm_timer&&) = delete;
+    tqdm_timer& operator=(tqdm_timer&&) = delete;
+    tqdm_timer& operator=(const tqdm_timer&) = delete;
+    ~tqdm_timer() { stop_background(); }
+
+    template <class Container>
+    tqdm_timer(Container&&) = delete; // prevent misuse!
+
+    iterator begin()
+    {
+        stop_background();
+        bar_.restart();
+        if (background_)
+        {
+            background_renderer::instance().add(
+              this, [this]() { render(); }, bar_.min_update_time());
+            in_background_ = true;
+        }
+        return iterator(timing_iterator(), this);
+    }
+
+    end_iterator end() const { return end_iterator(num_seconds_); }
+
+    void update()
+    {
+        if constexpr (!enabled) return;
+        if (background_ || bar_.skip_check()) return;
+        render();
+    }
+
+    // See tqdm_for_lvalues::render_in_background. Here the loop doesn't
+    // even need a counter: the renderer computes the progress from the time.
+    // Rendering starts in begin(), so the bar can be configured until then.
+    void render_in_background(bool on = true)
+    {
+        background_ = on;
+        if (!on) stop_background();
+    }
+
+    void set_ostream(std::ostream& os) { bar_.set_ostream(os); }
+    void set_prefix(std::string s) { bar_.set_prefix(std::move(s)); }
+    void set_bar_size(int size) { bar_.set_bar_size(size); }
+    void set_min_update_time(double time) { bar_.set_min_update_time(time); }
+    void set_output_mode(output_mode mode) { bar_.set_output_mode(mode); }
+    void set_log_interval(double seconds, double progress_step = 0.1)
+    {
+        bar_.set_log_interval(seconds, progress_step);
+    }
+    void set_json_output(std::FILE* f, double interval = 1)
+    {
+        bar_.set_json_output(f, interval);
+    }
+    void set_json_output(const std::string& path, double interval = 1)
+    {
+        bar_.set_json_output(path, interval);
+    }
+    void set_shared_export(bool on = true) { bar_.set_shared_export(on); }
+    void set_smoothing(double alpha) { bar_.set_smoothing(alpha); }
+    void set_miniters(index n) { bar_.set_miniters(n); }
+
+    template <class T>
+    tqdm_timer& operator<<(const T& t)
+    {
+        bar_ << t;
+        return *this;
+    }
+
+    template <class F>
+    void set_postfix(F f)
+    {
+        bar_.set_postfix(std::move(f));
+    }
+
+    template <class T>
+    void watch(std::string name, const T& value)
+    {
+        bar_.watch(std::move(name), value);
+    }
+
+    template <class T>
+    void watch(std::string name, const T&& value) = delete;
+
+    void clear_postfix() { bar_.clear_postfix(); }
+
+private:
+    void render()
+    {
+        double t = bar_.elapsed_time();
+
+        bar_.update(t/num_seconds_);
+    }
+
+    // The loop can't tell the renderer it's done, so the final state is
+    // displayed here.
+    void stop_background()
+    {
+        if (!in_background_) return;
+        background_renderer::instance().remove(this);
+        in_background_ = false;
+        bar_.redraw(bar_.elapsed_time()/num_seconds_);
+    }
+
+    double num_seconds_;
+    bool background_{false};
+    bool in_background_{false};
+    progress_bar bar_;
+};
+
+#ifdef TQDM_DISABLE
+inline auto tqdm(timer t) { return passthrough<timer>(t); }
+#else
+inline auto tqdm(timer t) { return tqdm_timer(t.num_seconds()); }
+#endif
+
+// -------------------- tqdm_bytes --------------------
+
+// Progress measured in bytes instead of iterations, for I/O loops:
+//
+//     tq::tqdm_bytes bar(file_size);
+//     while (auto n = read_chunk(buf)) { process(buf, n); bar.update(n); }
+//
+// Shows the amount processed and the throughput with SI (kB, MB, ...) or IEC
+// (KiB, MiB, ...) prefixes. A total <= 0 means unknown: no percentage or ETA.
+class tqdm_bytes
+{
+public:
+    explicit tqdm_bytes(index total_bytes,
+                        unit_scale scale = unit_scale::si)
+        : total_(total_bytes)
+    {
+        bar_.set_unit("B", scale);
+        bar_.set_total(total_);
+        bar_.set_indeterminate(total_ <= 0);
+    }
+
+    tqdm_bytes(const tqdm_bytes&) = delete;
+    tqdm_bytes(tqdm_bytes&&) = delete;
+    tqdm_bytes& operator=(tqdm_bytes&&) = delete;
+    tqdm_bytes& operator=(const tqdm_bytes&) = delete;
+    ~tqdm_bytes() { stop_background(); }
+
+    // Call once per chunk, with the number of bytes in it.
+    void update(index num_bytes)
+    {
+        if constexpr (!enabled) return;
+        index done = bytes_done_.load(std::memory_order_relaxed);
+        bytes_done_.store(done + num_bytes, std::memory_order_relaxed);
+
+        bool finishing = total_ > 0 && done < total_ &&
+                         done + num_bytes >= total_;
+        if (!finishing && background_ && done == 0) start_background();
+        if (!finishing && (background_ || bar_.skip_check())) return;
+
+        stop_background();
+        bar_.update(calc_progress(), bytes_done());
+    }
+
+    // Displays the final state, e.g. after reaching EOF with unknown total.
+    void finish()
+    {
+        if constexpr (!enabled) return;
+        stop_background();
+        bar_.redraw(calc_progress(), bytes_done());
+    }
+
+    void restart()
+    {
+        stop_background();
+        bar_.restart();
+        bytes_done_ = 0;
+    }
+
+    // See tqdm_for_lvalues::render_in_background. Rendering starts with the
+    // first update(), so the bar can be configured until then.
+    void render_in_background(bool on = true)
+    {
+        background_ = on;
+        if (!on) stop_background();
+    }
+
+    void set_ostream(std::ostream& os) { bar_.set_ostream(os); }
+    void set_prefix(std::string s) { bar_.set_prefix(std::move(s)); }
+    void set_bar_size(int size) { bar_.set_bar_size(size); }
+    void set_min_update_time(double time) { bar_.set_min_update_time(time); }
+    void set_output_mode(output_mode mode) { bar_.set_output_mode(mode); }
+    void set_log_interval(double seconds, double progress_step = 0.1)
+    {
+        bar_.set_log_interval(seconds, progress_step);
+    }
+    void set_json_output(std::FILE* f, double interval = 1)
+    {
+        bar_.set_json_output(f, interval);
+    }
+    void set_json_output(const std::string& path, double interval = 1)
+    {
+        bar_.set_json_output(path, interval);
+    }
+    void set_shared_export(bool on = true) { bar_.set_shared_export(on); }
+    void set_smoothing(double alpha) { bar_.set_smoothing(alpha); }
+    void set_miniters(index n) { bar_.set_miniters(n); }
+
+    template <class T>
+    tqdm_bytes& operator<<(const T& t)
+    {
+        bar_ << t;
+        return *this;
+    }
+
+    template <class F>
+    void set_postfix(F f)
+    {
+        bar_.set_postfix(std::move(f));
+    }
+
+    template <class T>
+    void watch(std::string name, const T& value)
+    {
+        bar_.watch(std::move(name), value);
+    }
+
+    template <class T>
+    void watch(std::string name, const T&& value) = delete;
+
+    void clear_postfix() { bar_.clear_postfix(); }
+
+    [[nodiscard]] index bytes_done() const
+    {
+        return bytes_done_.load(std::memory_order_relaxed);
+    }
+
+private:
+    double calc_progress() const
+    {
+        if (total_ <= 0) return 0;
+        return double(bytes_done())/total_;
+    }
+
+    void start_background()
+    {
+        if (in_background_) return;
+        background_renderer::instance().add(
+          this,
+          [this]() { bar_.update(calc_progress(), bytes_done()); },
+          bar_.min_update_time());
+        in_background_ = true;
+    }
+
+    void stop_background()
+    {
+        if (!in_background_) return;
+        background_renderer::instance().remove(this);
+        in_background_ = false;
+    }
+
+    index total_;
+    // atomic so the background renderer can read it; only update() writes
+    std::atomic<index> bytes_done_{0};
+    bool background_{false};
+    bool in_background_{false};
+    progress_bar bar_;
+};
+
+// -------------------- tqdm_file --------------------
+
+enum class file_split
+{
+    lines,
+    chunks
+};
+
+// Reads a file with a byte-counting bar, yielding either its lines (without
+// the '\n') or fixed-size chunks as string_views into a reused buffer:
+//
+//     for (std::string_view line : tq::tqdm_file("huge.log")) { ... }
+//
+// The views are only valid until the next iteration. The file is read with
+// unbuffered fread straight into the buffer, so it's as fast as raw read().
+// Lines longer than the buffer make it grow; nothing else allocates.
+class tqdm_file
+{
+public:
+    struct sentinel
+    {};
+
+    class iterator
+    {
+    public:
+        using iterator_category = std::input_iterator_tag;
+        using value_type = std::string_view;
+        using difference_type = index;
+        using pointer = const std::string_view*;
+        using reference = const std::string_view&;
+
+        explicit iterator(tqdm_file* parent) : parent_(parent) {}
+
+        reference operator*() const { return parent_->current_; }
+
+        iterator& operator++()
+        {
+            parent_->next();
+            return *this;
+        }
+
+        bool operator!=(sentinel) const { return !parent_->done_; }
+        bool operator==(sentinel) const { return parent_->done_; }
+
+    private:
+        tqdm_file* parent_;
+    };
+
+    explicit tqdm_file(const std::string& path,
+                       file_split split = file_split::lines,
+                       index buffer_size = 1 << 20)
+        : file_(std::fopen(path.c_str(), "rb"))
+        , path_(path)
+        , split_(split)
+        , buf_(std::max<index>(buffer_size, 1))
+        , bar_(file_size(path))
+    {
+        if (!file_) throw std::runtime_error("tqdm_file: can't open " + path);
+        std::setvbuf(file_, nullptr, _IONBF, 0);
+    }
+
+    tqdm_file(const tqdm_file&) = delete;
+    tqdm_file(tqdm_file&&) = delete;
+    tqdm_file& operator=(tqdm_file&&) = delete;
+    tqdm_file& operator=(const tqdm_file&) = delete;
+    ~tqdm_file() { std::fclose(file_); }
+
+    iterator begin()
+    {
+        if (started_) std::rewind(file_);
+        started_ = true;
+        pos_ = end_ = 0;
+        eof_ = done_ = false;
+        bar_.restart();
+        next();
+        return iterator(this);
+    }
+
+    [[nodiscard]] sentinel end() const { return {}; }
+
+    void set_ostream(std::ostream& os) { bar_.set_ostream(os); }
+    void set_prefix(std::string s) { bar_.set_prefix(std::move(s)); }
+    void set_bar_size(int size) { bar_.set_bar_size(size); }
+    void set_min_update_time(double time) { bar_.set_min_update_time(time); }
+    void set_output_mode(output_mode mode) { bar_.set_output_mode(mode); }
+    void set_log_interval(double seconds, double progress_step = 0.1)
+    {
+        bar_.set_log_interval(seconds, progress_step);
+    }
+    void set_json_output(std::FILE* f, double interval = 1)
+    {
+        bar_.set_json_output(f, interval);
+    }
+    void set_json_output(const std::string& path, double interval = 1)
+    {
+        bar_.set_json_output(path, interval);
+    }
+    void set_shared_export(bool on = true) { bar_.set_shared_export(on); }
+    void set_smoothing(double alpha) { bar_.set_smoothing(alpha); }
+    void render_in_background(bool on = true)
+    {
+        bar_.render_in_background(on);
+    }
+
+    template <class T>
+    tqdm_file& operator<<(const T& t)
+    {
+        bar_ << t;
+        return *this;
+    }
+
+    template <class F>
+    void set_postfix(F f)
+    {
+        bar_.set_postfix(std::move(f));
+    }
+
+    template <class T>
+    void watch(std::string name, const T& value)
+    {
+        bar_.watch(std::move(name), value);
+    }
+
+    template <class T>
+    void watch(std::string name, const T&& value) = delete;
+
+    void clear_postfix() { bar_.clear_postfix(); }
+
+private:
+    // 0 (unknown) for pipes and such.
+    static index file_size(const std::string& path)
+    {
+        std::error_code ec;
+        auto size = std::filesystem::file_size(path, ec);
+        return ec ? 0 : static_cast<index>(size);
+    }
+
+    void next()
+    {
+        if (split_ == file_split::chunks)
+            next_chunk();
+        else
+            next_line();
+
+        if (done_) bar_.finish();
+    }
+
+    void next_chunk()
+    {
+        pos_ = end_ = 0;
+        read_more();
+        current_ = std::string_view(buf_.data(), end_);
+        done_ = (end_ == 0);
+    }
+
+    void next_line()
+    {
+        while (true)
+        {
+            const char* first = buf_.data() + pos_;
+            index available = end_ - pos_;
+            auto newline =
+              static_cast<const char*>(std::memchr(first, '\n', available));
+
+            if (newline)
+            {
+                current_ = std::string_view(first, newline - first);
+                pos_ += current_.size() + 1;
+                return;
+            }
+
+            if (eof_)
+            {
+                // last line, without a trailing '\n'
+                current_ = std::string_view(first, available);
+                pos_ = end_;
+                done_ = (available == 0);
+                return;
+            }
+
+            read_more();
+        }
+    }
+
+    // Moves the unconsumed bytes to the front and fills the rest. Throws if
+    // reading fails, so an I/O error doesn't look like the end of the file.
+    void read_more()
+    {
+        index leftover = end_ - pos_;
+        std::memmove(buf_.data(), buf_.data() + pos_, leftover);
+        pos_ = 0;
+        end_ = leftover;
+        if (end_ == static_cast<index>(buf_.size())) buf_.resize(2*buf_.size());
+
+        index n = std::fread(buf_.data() + end_, 1, buf_.size() - end_, file_);
+        if (std::ferror(file_))
+        {
+            throw std::runtime_error("tqdm_file: can't read " + path_ + ": " +
+                                     std::strerror(errno));
+        }
+        if (n == 0) eof_ = true;
+        end_ += n;
+        bar_.update(n);
+    }
+
+    std::FILE* file_;
+    std::string path_;
+    file_split split_;
+    std::vector<char> buf_;
+    index pos_{0}; // start of the unconsumed bytes in buf_
+    index end_{0}; // end of the valid bytes in buf_
+    bool started_{false};
+    bool eof_{false};
+    bool done_{false};
+    std::string_view current_{};
+    tqdm_bytes bar_;
+};
+
+// -------------------- tqdm_mmap --------------------
+#ifdef TQDM_HAS_MMAP
+
+// Like tqdm_file, but maps the file into memory instead of reading it, so the
+// views point straight into the page cache and nothing is ever copied:
+//
+//     for (std::string_view line : tq::tqdm_mmap("huge.log")) { ... }
+//
+// With file_split::chunks it yields fixed-size records of record_size bytes
+// (the last one may be shorter). The views stay valid while the tqdm_mmap
+// lives. The kernel is told the access is sequential, and set_prefetch asks
+// it to start reading some bytes ahead of the current position.
+class tqdm_mmap
+{
+public:
+    struct sentinel
+    {};
+
+    class iterator
+    {
+    public:
+        using iterator_category = std::input_iterator_tag;
+        using value_type = std::string_view;
+        using difference_type = index;
+        using pointer = const std::string_view*;
+        using reference = const std::string_view&;
+
+        explicit iterator(tqdm_mmap* parent) : parent_(parent) {}
+
+        reference operator*() const { return parent_->current_; }
+
+        iterator& operator++()
+        {
+            parent_->next();
+            return *this;
+        }
+
+        bool operator!=(sentinel) const { return !parent_->done_; }
+        bool operator==(sentinel) const { return parent_->done_; }
+
+    private:
+        tqdm_mmap* parent_;
+    };
+
+    explicit tqdm_mmap(const std::string& path,
+                       file_split split = file_split::lines,
+                       index record_size = 1 << 20)
+        : split_(split)
+        , record_size_(std::max<index>(record_size, 1))
+        , size_(map(path))
+        , bar_(size_)
+    {}
+
+    tqdm_mmap(const tqdm_mmap&) = delete;
+    tqdm_mmap(tqdm_mmap&&) = delete;
+    tqdm_mmap& operator=(tqdm_mmap&&) = delete;
+    tqdm_mmap& operator=(const tqdm_mmap&) = delete;
+    ~tqdm_mmap()
+    {
+        if (size_ > 0) munmap(const_cast<char*>(data_), size_);
+    }
+
+    iterator begin()
+    {
+        pos_ = 0;
+        reported_ = 0;
+        next_mark_ = 0;
+        done_ = false;
+        bar_.restart();
+        next();
+        return iterator(this);
+    }
+
+    [[nodiscard]] sentinel end() const { return {}; }
+
+    // Hint the kernel to read this many bytes ahead (0, the default, means
+    // just rely on the sequential access hint).
+    void set_prefetch(index bytes) { prefetch_ = std::max<index>(bytes, 0); }
+
+    void set_ostream(std::ostream& os) { bar_.set_ostream(os); }
+    void set_prefix(std::string s) { bar_.set_prefix(std::move(s)); }
+    void set_bar_size(int size) { bar_.set_bar_size(size); }
+    void set_min_update_time(double time) { bar_.set_min_update_time(time); }
+    void set_output_mode(output_mode mode) { bar_.set_output_mode(mode); }
+    void set_log_interval(double seconds, double progress_step = 0.1)
+    {
+        bar_.set_log_interval(seconds, progress_step);
+    }
+    void set_json_output(std::FILE* f, double interval = 1)
+    {
+        bar_.set_json_output(f, interval);
+    }
+    void set_json_output(const std::string& path, double interval = 1)
+    {
+        bar_.set_json_output(path, interval);
+    }
+    void set_shared_export(bool on = true) { bar_.set_shared_export(on); }
+    void set_smoothing(double alpha) { bar_.set_smoothing(alpha); }
+    void render_in_background(bool on = true)
+    {
+        bar_.render_in_background(on);
+    }
+
+    template <class T>
+    tqdm_mmap& operator<<(const T& t)
+    {
+        bar_ << t;
+        return *this;
+    }
+
+    template <class F>
+    void set_postfix(F f)
+    {
+        bar_.set_postfix(std::move(f));
+    }
+
+    template <class T>
+    void watch(std::string name, const T& value)
+    {
+        bar_.watch(std::move(name), value);
+    }
+
+    template <class T>
+    void watch(std::string name, const T&& value) = delete;
+
+    void clear_postfix() { bar_.clear_postfix(); }
+
+private:
+    // Returns the size of the file.
+    index map(const std::string& path)
+    {
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0) throw std::runtime_error("tqdm_mmap: can't open " + path);
+
+        struct stat st{};
+        fstat(fd, &st);
+        index size = st.st_size;
+        if (size > 0)
+        {
+            void* p = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p == MAP_FAILED)
+            {
+                close(fd);
+                throw std::runtime_error("tqdm_mmap: can't map " + path);
+            }
+            madvise(p, size, MADV_SEQUENTIAL);
+            data_ = static_cast<const char*>(p);
+        }
+        close(fd); // the mapping keeps the file alive
+        return size;
+    }
+
+    void next()
+    {
+        if (pos_ >= size_)
+        {
+            done_ = true;
+            report_progress();
+            bar_.finish();
+            return;
+        }
+
+        const char* first = data_ + pos_;
+        index available = size_ - pos_;
+        index length = std::min(record_size_, available);
+        index skip = length;
+
+        if (split_ == file_split::lines)
+        {
+            auto newline =
+              static_cast<const char*>(std::memchr(first, '\n', available));
+            length = newline ? newline - first : available;
+            skip = length + 1;
+        }
+
+        current_ = std::string_view(first, length);
+        pos_ += skip;
+        if (pos_ >= next_mark_) report_progress();
+    }
+
+    // Called every progress_step bytes rather than on every record, so
+    // iterating costs one comparison per record on top of the memchr.
+    void report_progress()
+    {
+        index pos = std::min(pos_, size_);
+        bar_.update(pos - reported_);
+        reported_ = pos;
+        next_mark_ = pos + progress_step;
+
+        if (prefetch_ > 0 && pos < size_)
+        {
+            static const index page_size = sysconf(_SC_PAGESIZE);
+            index from = pos/page_size*page_size;
+            index len = std::min(prefetch_, size_ - from);
+            madvise(const_cast<char*>(data_) + from, len, MADV_WILLNEED);
+        }
+    }
+
+    static constexpr index progress_step = 1 << 20;
+
+    file_split split_;
+    index record_size_;
+    const char* data_{nullptr};
+    index size_;
+    index pos_{0};
+    index reported_{0};
+    index next_mark_{0};
+    index prefetch_{0};
+    bool done_{false};
+    std::string_view current_{};
+    tqdm_bytes bar_;
+};
+
+#endif // TQDM_HAS_MMAP
+
+// -------------------- sharded_counter --------------------
+
+constexpr std::size_t cache_line_size = 64;
+
+// Hands out small integers to threads. A thread gives its slot back when it
+// exits, so programs that keep creating threads still give live threads
+// distinct slots (as long as there are few enough of them).
+class thread_slot_pool
+{
+public:
+    static thread_slot_pool& instance()
+    {
+        static thread_slot_pool pool;
+        return pool;
+    }
+
+    thread_slot_pool(const thread_slot_pool&) = delete;
+    thread_slot_pool(thread_slot_pool&&) = delete;
+    thread_slot_pool& operator=(thread_slot_pool&&) = delete;
+    thread_slot_pool& operator=(const thread_slot_pool&) = delete;
+    ~thread_slot_pool() = default;
+
+    index acquire()
+    {
+        std::lock_guard lock(mutex_);
+        if (free_.empty()) return next_slot_++;
+        // Reuse the lowest free slot, to keep slots of live threads small.
+        auto lowest = std::min_element(free_.begin(), free_.end());
+        index slot = *lowest;
+        *lowest = free_.back();
+        free_.pop_back();
+        return slot;
+    }
+
+    void release(index slot)
+    {
+        std::lock_guard lock(mutex_);
+        free_.push_back(slot);
+    }
+
+private:
+    thread_slot_pool() = default;
+
+    std::mutex mutex_;
+    std::vector<index> free_;
+    index next_slot_{0};
+};
+
+// Small integer identifying the calling thread, assigned on first use and
+// released when the thread exits.
+inline index this_thread_slot()
 {
-    return tqdm_for_lvalues(C);
+    struct slot_guard
+    {
+        index slot{thread_slot_pool::instance().acquire()};
+        ~slot_guard() { thread_slot_pool::instance().release(slot); }
+    };
+    // The guard needs a check for initialization on every access, so the
+    // slot is also cached in a plain thread_local for the fast path.
+    thread_local index slot = -1;
+    if (slot < 0)
+    {
+        thread_local slot_guard guard;
+        slot = guard.slot;
+    }
+    return slot;
 }
 
-template <class Container>
-auto tqdm(Container&& C)
+// Counter that many threads can add to without fighting over a cache line:
+// each thread adds to its own shard and readers sum all shards.
+class sharded_counter
 {
-    return tqdm_for_rvalues(std::forward<Container>(C));
-}
+public:
+    static constexpr index num_shards = 64;
 
-// -------------------- int_iterator --------------------
+    // Returns the value of this thread's shard before adding.
+    index add(index n)
+    {
+        auto& shard = shards_[this_thread_slot()%num_shards].value;
+        return shard.fetch_add(n, std::memory_order_relaxed);
+    }
 
-template <class IntType>
-class int_iterator
+    [[nodiscard]] index sum() const
+    {
+        index total = 0;
+        for (auto& shard : shards_)
+            total += shard.value.load(std::memory_order_relaxed);
+        return total;
+    }
+
+    void reset()
+    {
+        for (auto& shard : shards_)
+            shard.value.store(0, std::memory_order_relaxed);
+    }
+
+private:
+    struct alignas(cache_line_size) shard_t
+    {
+        std::atomic<index> value{0};
+    };
+
+    std::array<shard_t, num_shards> shards_{};
+};
+
+// -------------------- concurrent_progress --------------------
+
+// A bar that many threads can advance at the same time:
+//
+//     tq::concurrent_progress P(num_tasks);
+//     // in each worker thread:
+//     P.update(); // or P.advance(n)
+//
+// Advancing is a relaxed add to a per-thread shard. Every few (adaptively
+// many) advances a thread tries to become the renderer; if another thread is
+// already rendering it just goes on, so no thread ever waits for a lock.
+class concurrent_progress
 {
 public:
-    using iterator_category = std::random_access_iterator_tag;
-    using value_type = IntType;
-    using difference_type = IntType;
-    using pointer = IntType*;
-    using reference = IntType&;
+    explicit concurrent_progress(index total) : num_iters_(total)
+    {
+        bar_.set_miniters(1); // only the renderer talks to bar_
+        bar_.set_total(total);
+    }
 
-    explicit int_iterator(IntType val) : value_(val) {}
+    concurrent_progress(const concurrent_progress&) = delete;
+    concurrent_progress(concurrent_progress&&) = delete;
+    concurrent_progress& operator=(concurrent_progress&&) = delete;
+    concurrent_progress& operator=(const concurrent_progress&) = delete;
+    ~concurrent_progress() { render_in_background(false); }
 
-    IntType& operator*() { return value_; }
+    void update() { advance(1); }
 
-    int_iterator& operator++()
+    void advance(index amount)
     {
-        ++value_;
-        return *this;
+        if constexpr (!enabled) return;
+        index before = counter_.add(amount);
+        int k = stride_log2_.load(std::memory_order_relaxed);
+        if (((before + amount) >> k) != (before >> k)) try_render();
     }
-    int_iterator& operator--()
+
+    // Displays the final state. Waits for a concurrent renderer to finish.
+    void finish()
     {
-        --value_;
-        return *this;
+        if constexpr (!enabled) return;
+        render_in_background(false);
+        while (rendering_.exchange(true, std::memory_order_acquire)) {}
+        render();
+        rendering_.store(false, std::memory_order_release);
     }
 
-    int_iterator& operator+=(difference_type d)
+    // Not thread-safe: call these before the workers start.
+    void restart()
     {
-        value_ += d;
-        return *this;
+        counter_.reset();
+        bar_.restart();
+        last_check_ = 0;
+        last_done_ = 0;
     }
 
-    difference_type operator-(const int_iterator& other) const
+    void set_ostream(std::ostream& os) { bar_.set_ostream(os); }
+    void set_prefix(std::string s) { bar_.set_prefix(std::move(s)); }
+    void set_bar_size(int size) { bar_.set_bar_size(size); }
+    void set_min_update_time(double time)
     {
-        return value_ - other.value_;
+        min_time_per_update_ = time;
+        bar_.set_min_update_time(time);
+    }
+    void set_output_mode(output_mode mode) { bar_.set_output_mode(mode); }
+    void set_log_interval(double seconds, double progress_step = 0.1)
+    {
+        bar_.set_log_interval(seconds, progress_step);
+    }
+    void set_json_output(std::FILE* f, double interval = 1)
+    {
+        bar_.set_json_output(f, interval);
+    }
+    void set_json_output(const std::string& path, double interval = 1)
+    {
+        bar_.set_json_output(path, interval);
+    }
+    void set_shared_export(bool on = true) { bar_.set_shared_export(on); }
+    void set_smoothing(double alpha) { bar_.set_smoothing(alpha); }
+    void set_unit(std::string unit, unit_scale scale = unit_scale::none)
+    {
+        bar_.set_unit(std::move(unit), scale);
     }
 
-    bool operator!=(const int_iterator& other) const
+    // Evaluated by whichever thread renders, so make sure that's safe.
+    template <class F>
+    void set_postfix(F f)
     {
-        return value_ != other.value_;
+        bar_.set_postfix(std::move(f));
     }
 
-private:
-    IntType value_;
-};
+    template <class T>
+    void watch(std::string name, const T& value)
+    {
+        bar_.watch(std::move(name), value);
+    }
 
-// -------------------- range --------------------
-template <class IntType>
-class range
-{
-public:
-    using iterator = int_iterator<IntType>;
-    using const_iterator = iterator;
-    using value_type = IntType;
+    template <class T>
+    void watch(std::string name, const T&& value) = delete;
 
-    range(IntType first, IntType last) : first_(first), last_(last) {}
-    explicit range(IntType last) : first_(0), last_(last) {}
+    // Leaves all rendering to the background_renderer thread: advance()
+    // never tries to render, it only adds to the counter. Rendering starts
+    // right away, so configure the bar first.
+    void render_in_background(bool on = true)
+    {
+        if (on == in_background_) return;
+        if (on)
+        {
+            in_background_ = true;
+            stride_log2_.store(62, std::memory_order_relaxed); // never crossed
+            background_renderer::instance().add(
+              this, [this]() { try_render(); }, min_time_per_update_);
+        }
+        else
+        {
+            background_renderer::instance().remove(this);
+            in_background_ = false;
+            stride_log2_.store(0, std::memory_order_relaxed);
+        }
+    }
 
-    [[nodiscard]] iterator begin() const { return first_; }
-    [[nodiscard]] iterator end() const { return last_; }
-    [[nodiscard]] index size() const { return last_ - first_; }
+    [[nodiscard]] index count() const { return counter_.sum(); }
 
 private:
-    iterator first_;
-    iterator last_;
-};
+    void try_render()
+    {
+        // test before exchanging, so waiting threads don't bounce the line
+        if (rendering_.load(std::memory_order_relaxed) ||
+            rendering_.exchange(true, std::memory_order_acquire))
+            return;
 
-template <class IntType>
-auto trange(IntType first, IntType last)
-{
-    return tqdm(range(first, last));
-}
+        render();
+        rendering_.store(false, std::memory_order_release);
+    }
 
-template <class IntType>
-auto trange(IntType last)
-{
-    return tqdm(range(last));
-}
+    void render()
+    {
+        index done = counter_.sum();
+        double t = bar_.elapsed_time();
+        if (!in_background_) adapt_stride(done, t);
 
-// -------------------- timing_iterator --------------------
+        double denominator = num_iters_;
+        if (num_iters_ == 0) denominator += 1e-9;
+        bar_.update(done/denominator, done);
+    }
 
-class timing_iterator_end_sentinel
-{
-public:
-    explicit timing_iterator_end_sentinel(double num_seconds)
-        : num_seconds_(num_seconds)
-    {}
+    // Same idea as progress_bar::adapt_miniters, but the stride is a power
+    // of two so the hot path can test for crossing it with a shift.
+    void adapt_stride(index done, double t)
+    {
+        double dt = t - last_check_;
+        double iters = std::max<index>(done - last_done_, 1);
+        last_check_ = t;
+        last_done_ = done;
 
-    [[nodiscard]] double num_seconds() const { return num_seconds_; }
+        int k = stride_log2_.load(std::memory_order_relaxed);
+        double target = std::exp2(k + 1);
+        if (dt > 0)
+        {
+            double rate = iters/dt;
+            target = std::min(target,
+                              rate*min_time_per_update_/checks_per_refresh_);
+        }
+        clamp(target, 1, max_stride_);
+        stride_log2_.store(std::ilogb(target), std::memory_order_relaxed);
+    }
 
-private:
-    double num_seconds_;
+    sharded_counter counter_{};
+    alignas(cache_line_size) std::atomic<int> stride_log2_{0};
+    alignas(cache_line_size) std::atomic<bool> rendering_{false};
+
+    // only touched by the thread holding rendering_
+    alignas(cache_line_size) index num_iters_;
+    double last_check_{0};
+    index last_done_{0};
+    double min_time_per_update_{0.15};
+    bool in_background_{false};
+    static constexpr double checks_per_refresh_{200};
+    static constexpr double max_stride_{1 << 20};
+    progress_bar bar_;
 };
 
-class timing_iterator
+// -------------------- parallel_for --------------------
+
+struct parallel_options
 {
-public:
-    using iterator_category = std::forward_iterator_tag;
-    using value_type = double;
-    using difference_type = double;
-    using pointer = double*;
-    using reference = double&;
+    unsigned num_threads{0}; // 0 means std::thread::hardware_concurrency()
+    index grain_size{0};     // elements per task; 0 picks one
+    std::string prefix{};
+    std::ostream* os{&std::cerr};
+};
 
-    double operator*() const { return chrono_.peek(); }
+// Calls fn(x) for every element x of r (a random access range, e.g. a
+// vector or a tq::range) on num_threads threads, including the calling one,
+// with a single bar for all of them:
+//
+//     tq::parallel_for(tq::range(n), [&](int i) { out[i] = f(in[i]); });
+//
+// Each thread starts with an equal slice of the range and takes grain_size
+// elements at a time from its front; a thread that runs out steals the back
+// half of another one's slice, so uneven work still keeps everyone busy.
+// Progress is reported through a concurrent_progress once per grain. If fn
+// throws, the remaining elements are skipped and the first exception is
+// rethrown once all threads are done.
+template <class Range, class F>
+void parallel_for(Range&& r, F fn, const parallel_options& options = {})
+{
+    auto first = std::begin(r);
+    using iterator = decltype(first);
+    static_assert(
+      std::is_base_of_v<std::random_access_iterator_tag,
+                        typename std::iterator_traits<iterator>::
+                          iterator_category>,
+      "parallel_for needs a random access range");
 
-    timing_iterator& operator++() { return *this; }
+    index total = std::distance(first, std::end(r));
+    index num_threads = options.num_threads;
+    if (num_threads == 0)
+        num_threads = std::max(1u, std::thread::hardware_concurrency());
+    num_threads = std::max<index>(1, std::min(num_threads, total));
+    index grain = options.grain_size;
+    if (grain <= 0) grain = std::clamp<index>(total/(num_threads*64), 1, 4096);
 
-    bool operator!=(const timing_iterator_end_sentinel& other) const
+    // [next, end) is what's left of each thread's slice
+    struct alignas(cache_line_size) slice
     {
-        return chrono_.peek() < other.num_seconds();
+        std::mutex mutex;
+        index next{0};
+        index end{0};
+    };
+    std::vector<slice> slices(num_threads);
+    for (index i = 0; i < num_threads; ++i)
+    {
+        slices[i].next = total*i/num_threads;
+        slices[i].end = total*(i + 1)/num_threads;
     }
 
-private:
-    tq::Chronometer chrono_;
-};
+    concurrent_progress progress(total);
+    progress.set_prefix(options.prefix);
+    progress.set_ostream(*options.os);
 
-// -------------------- timer -------------------
-struct timer
-{
-public:
-    using iterator = timing_iterator;
-    using end_iterator = timing_iterator_end_sentinel;
-    using const_iterator = iterator;
-    using value_type = double;
+    std::atomic<bool> failed{false};
+    std::exception_ptr error;
+    std::mutex error_mutex;
 
-    explicit timer(double num_seconds) : num_seconds_(num_seconds) {}
+    auto take = [&](index me, index& task_first, index& task_last) {
+        {
+            std::lock_guard lock(slices[me].mutex);
+            auto& s = slices[me];
+            if (s.next < s.end)
+            {
+                task_first = s.next;
+                task_last = s.next = std::min(s.end, s.next + grain);
+                return true;
+            }
+        }
+        for (index k = 1; k < num_threads; ++k)
+        {
+            auto& victim = slices[(me + k)%num_threads];
+            index stolen_first, stolen_last;
+            {
+                std::lock_guard lock(victim.mutex);
+                index left = victim.end - victim.next;
+                if (left <= 0) continue;
+                stolen_first = victim.end - (left + 1)/2;
+                stolen_last = victim.end;
+                victim.end = stolen_first;
+            }
+            task_first = stolen_first;
+            task_last = std::min(stolen_last, stolen_first + grain);
+            std::lock_guard lock(slices[me].mutex);
+            slices[me].next = task_last;
+            slices[me].end = stolen_last;
+            return true;
+        }
+        return false;
+    };
 
-    [[nodiscard]] static iterator begin() { return iterator(); }
-    [[nodiscard]] end_iterator end() const
-    {
-        return end_iterator(num_seconds_);
-    }
+    auto work = [&](index me) {
+        iterator begin = first; // a local copy, so stores by fn can't alias it
+        index task_first, task_last;
+        while (!failed.load(std::memory_order_relaxed) &&
+               take(me, task_first, task_last))
+        {
+            try
+            {
+                auto last = begin + task_last;
+                for (auto it = begin + task_first; it != last; ++it) fn(*it);
+            }
+            catch (...)
+            {
+                std::lock_guard lock(error_mutex);
+                if (!error) error = std::current_exception();
+                failed = true;
+            }
+            progress.advance(task_last - task_first);
+        }
+    };
 
-    [[nodiscard]] double num_seconds() const { return num_seconds_; }
+    std::vector<std::thread> threads;
+    for (index i = 1; i < num_threads; ++i) threads.emplace_back(work, i);
+    work(0);
+    for (auto& t : threads) t.join();
 
-private:
-    double num_seconds_;
-};
+    progress.finish();
+    if (error) std::rethrow_exception(error);
+}
 
-class tqdm_timer
+// -------------------- omp_progress --------------------
+
+// A bar for OpenMP loops, which can't use the range-for wrappers:
+//
+//     tq::omp_progress P(n);
+//     #pragma omp parallel for
+//     for (int i = 0; i < n; ++i)
+//     {
+//         work(i);
+//         P.tick();
+//     }
+//     P.finish();
+//
+// Each thread counts in its own cache line, and since nobody else writes
+// there, a tick is a plain load and store: no atomic read-modify-write, no
+// contention, no false sharing. Threads claim a line on their first tick and
+// remember it in a small thread_local cache (one entry per bar, so several
+// bars can tick in the same loop), which is cheaper than asking OpenMP for
+// the thread number every time. Only the thread that made the bar (the master,
+// for a parallel region it starts) sums the lines and renders, every few
+// ticks. With a static schedule the master may finish its share early and
+// leave the bar still until the end; use a dynamic schedule or
+// render_in_background() then. Nothing here is OpenMP specific, so ticking
+// from std::threads works too. If more threads tick than the team size
+// OpenMP reported, the extra ones share an atomic.
+class omp_progress
 {
 public:
-    using iterator = iter_wrapper<timing_iterator, tqdm_timer>;
-    using end_iterator = timer::end_iterator;
-    using value_type = typename timing_iterator::value_type;
-    using size_type = index;
-    using difference_type = index;
-
-    explicit tqdm_timer(double num_seconds) : num_seconds_(num_seconds) {}
+    explicit omp_progress(index total)
+        : num_iters_(total), counters_(enabled ? max_threads() : 0)
+    {
+        bar_.set_total(total);
+        if constexpr (enabled) find_counter(); // the master gets counter 0
+    }
 
-    tqdm_timer(const tqdm_timer&) = delete;
-    tqdm_timer(tqdm_timer&&) = delete;
-    tqdm_timer& operator=(tqdm_timer&&) = delete;
-    tqdm_timer& operator=(const tqdm_timer&) = delete;
-    ~tqdm_timer() = default;
+    omp_progress(const omp_progress&) = delete;
+    omp_progress(omp_progress&&) = delete;
+    omp_progress& operator=(omp_progress&&) = delete;
+    omp_progress& operator=(const omp_progress&) = delete;
+    ~omp_progress() { render_in_background(false); }
 
-    template <class Container>
-    tqdm_timer(Container&&) = delete; // prevent misuse!
+    void tick() { advance(1); }
 
-    iterator begin()
+    void advance(index amount)
     {
-        bar_.restart();
-        return iterator(timing_iterator(), this);
-    }
+        if constexpr (!enabled) return;
+        index t = find_counter();
+        if (t >= index(counters_.size()))
+        {
+            overflow_.fetch_add(amount, std::memory_order_relaxed);
+            return;
+        }
 
-    end_iterator end() const { return end_iterator(num_seconds_); }
+        auto& c = counters_[t].value;
+        c.store(c.load(std::memory_order_relaxed) + amount,
+                std::memory_order_relaxed);
+        if (t == 0 && !in_background_ && !bar_.skip_check()) render();
+    }
 
-    void update()
+    // Call after the parallel region, from the thread that started it.
+    void finish()
     {
-        double t = bar_.elapsed_time();
+        if constexpr (!enabled) return;
+        render_in_background(false);
+        bar_.redraw(progress(), count());
+    }
 
-        bar_.update(t/num_seconds_);
+    // Not thread-safe: call before the parallel region.
+    void restart()
+    {
+        for (auto& c : counters_) c.value.store(0, std::memory_order_relaxed);
+        overflow_.store(0, std::memory_order_relaxed);
+        bar_.restart();
     }
 
     void set_ostream(std::ostream& os) { bar_.set_ostream(os); }
     void set_prefix(std::string s) { bar_.set_prefix(std::move(s)); }
     void set_bar_size(int size) { bar_.set_bar_size(size); }
     void set_min_update_time(double time) { bar_.set_min_update_time(time); }
+    void set_output_mode(output_mode mode) { bar_.set_output_mode(mode); }
+    void set_log_interval(double seconds, double progress_step = 0.1)
+    {
+        bar_.set_log_interval(seconds, progress_step);
+    }
+    void set_json_output(std::FILE* f, double interval = 1)
+    {
+        bar_.set_json_output(f, interval);
+    }
+    void set_json_output(const std::string& path, double interval = 1)
+    {
+        bar_.set_json_output(path, interval);
+    }
+    void set_shared_export(bool on = true) { bar_.set_shared_export(on); }
+    void set_smoothing(double alpha) { bar_.set_smoothing(alpha); }
+    void set_unit(std::string unit, unit_scale scale = unit_scale::none)
+    {
+        bar_.set_unit(std::move(unit), scale);
+    }
+    void set_miniters(index n) { bar_.set_miniters(n); }
+
+    // Evaluated by whichever thread renders, so make sure that's safe.
+    template <class F>
+    void set_postfix(F f)
+    {
+        bar_.set_postfix(std::move(f));
+    }
 
     template <class T>
-    tqdm_timer& operator<<(const T& t)
+    void watch(std::string name, const T& value)
     {
-        bar_ << t;
-        return *this;
+        bar_.watch(std::move(name), value);
+    }
+
+    template <class T>
+    void watch(std::string name, const T&& value) = delete;
+
+    // Render from the background_renderer thread instead of the master,
+    // which then only counts like the other threads. Call before the
+    // parallel region.
+    void render_in_background(bool on = true)
+    {
+        if (on == in_background_) return;
+        if (on)
+        {
+            in_background_ = true;
+            background_renderer::instance().add(
+              this, [this]() { render(); }, bar_.min_update_time());
+        }
+        else
+        {
+            background_renderer::instance().remove(this);
+            in_background_ = false;
+        }
+    }
+
+    [[nodiscard]] index count() const
+    {
+        index total = overflow_.load(std::memory_order_relaxed);
+        for (auto& c : counters_)
+            total += c.value.load(std::memory_order_relaxed);
+        return total;
     }
 
 private:
-    double num_seconds_;
+    static index max_threads()
+    {
+#ifdef _OPENMP
+        return omp_get_max_threads();
+#else
+        return 1;
+#endif
+    }
+
+    // The counters this thread used last, and which bars they belong to.
+    // Bars are told apart by id rather than address, which a new bar may
+    // reuse. With more bars than entries in use at once, the oldest entry is
+    // evicted; the bar then finds the counter again in own_counter().
+    static constexpr int cache_size = 8;
+
+    struct counter_cache
+    {
+        struct entry
+        {
+            std::uint64_t owner;
+            index counter;
+        };
+
+        std::array<entry, cache_size> entries;
+        int next;
+    };
+
+    static counter_cache& cached_counters()
+    {
+        thread_local counter_cache cache{};
+        return cache;
+    }
+
+    static std::uint64_t new_id()
+    {
+        static std::atomic<std::uint64_t> next_id{1};
+        return next_id.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    index find_counter()
+    {
+        auto& cache = cached_counters();
+        for (const auto& e : cache.entries)
+            if (e.owner == id_) return e.counter;
+
+        index t = own_counter();
+        cache.entries[cache.next] = {id_, t};
+        cache.next = (cache.next + 1)%cache_size;
+        return t;
+    }
+
+    // The counter this thread claimed before, or a new one. Only runs when
+    // the counter isn't in the cache, so the linear search is fine.
+    index own_counter()
+    {
+        auto me = std::this_thread::get_id();
+        index claimed = std::min(next_counter_.load(std::memory_order_relaxed),
+                                 index(counters_.size()));
+        for (index t = 0; t < claimed; ++t)
+            if (counters_[t].owner.load(std::memory_order_relaxed) == me)
+                return t;
+
+        index t = next_counter_.fetch_add(1, std::memory_order_relaxed);
+        if (t < index(counters_.size()))
+            counters_[t].owner.store(me, std::memory_order_relaxed);
+        return t;
+    }
+
+    double progress() const
+    {
+        double denominator = num_iters_;
+        if (num_iters_ == 0) denominator += 1e-9;
+        return count()/denominator;
+    }
+
+    void render() { bar_.update(progress(), count()); }
+
+    struct alignas(cache_line_size) counter
+    {
+        std::atomic<index> value{0};
+        std::atomic<std::thread::id> owner{};
+    };
+
+    index num_iters_;
+    std::uint64_t id_{new_id()};
+    std::vector<counter> counters_;
+    alignas(cache_line_size) std::atomic<index> overflow_{0};
+    std::atomic<index> next_counter_{0};
+    bool in_background_{false};
     progress_bar bar_;
 };
 
-inline auto tqdm(timer t) { return tqdm_timer(t.num_seconds()); }
-
 } // namespace tq
@@ -0,0 +1,182 @@
+// A small pv-like pipe meter: copies stdin to stdout and shows the amount
+// copied and the throughput on stderr.
+//
+//     g++ -O2 -std=c++17 -pthread tqpv.cpp -o tqpv
+//     producer | ./tqpv -s 10G | consumer
+//
+// Options:
+//     -s SIZE   expected size, for the percentage and ETA. Accepts K, M, G
+//               and T suffixes (powers of 1024). Defaults to the size of
+//               stdin if it's a regular file.
+//     -N NAME   prefix the bar with NAME.
+//     -i        show IEC units (MiB/s) instead of SI (MB/s).
+//
+// On Linux it moves data with splice(2) when stdin or stdout is a pipe, so
+// the bytes never go through userspace; otherwise it uses a large buffer.
+// The bar is drawn by tqdm's background thread, so the copy loop only adds
+// to a counter, and the display keeps updating even if the pipe stalls.
+//
+// Like cat, it exits with status 1 if reading or writing fails.
+
+#include <cerrno>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+#ifdef __linux__
+#include <fcntl.h>
+#endif
+
+#include "tqdm.hpp"
+
+const std::size_t chunk_size = 1 << 20;
+
+// The first system call that failed, reported once the bar is done.
+const char* failed_call = nullptr;
+int failed_errno = 0;
+
+bool fail(const char* call)
+{
+    failed_call = call;
+    failed_errno = errno;
+    return false;
+}
+
+// Returns -1 if s isn't a valid size.
+tq::index parse_size(const char* s)
+{
+    char* suffix = nullptr;
+    double size = std::strtod(s, &suffix);
+    if (suffix == s || !std::isfinite(size) || size < 0) return -1;
+    if (*suffix != '\0' &&
+        (std::strchr("KkMmGgTt", *suffix) == nullptr || suffix[1] != '\0'))
+        return -1;
+    switch (*suffix)
+    {
+    case 'T':
+    case 't': size *= 1024;
+    [[fallthrough]];
+    case 'G':
+    case 'g': size *= 1024;
+    [[fallthrough]];
+    case 'M':
+    case 'm': size *= 1024;
+    [[fallthrough]];
+    case 'K':
+    case 'k': size *= 1024;
+    }
+    if (size >= 9e18) return -1;
+    return static_cast<tq::index>(size);
+}
+
+tq::index stdin_size()
+{
+    struct stat st{};
+    if (fstat(STDIN_FILENO, &st) == 0 && S_ISREG(st.st_mode))
+        return st.st_size;
+    return 0;
+}
+
+bool write_all(const char* data, std::size_t size)
+{
+    while (size > 0)
+    {
+        ssize_t n = write(STDOUT_FILENO, data, size);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return fail("write");
+        data += n;
+        size -= n;
+    }
+    return true;
+}
+
+// Returns false if splice can't be used for these file descriptors.
+// Other errors end the copy and are recorded with fail().
+bool copy_with_splice(tq::tqdm_bytes& bar)
+{
+#ifdef __linux__
+    bool first = true;
+    while (true)
+    {
+        ssize_t n = splice(STDIN_FILENO,
+                           nullptr,
+                           STDOUT_FILENO,
+                           nullptr,
+                           chunk_size,
+                           SPLICE_F_MOVE | SPLICE_F_MORE);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && first && (errno == EINVAL || errno == ENOSYS))
+            return false;
+        if (n < 0) fail("splice");
+        if (n <= 0) return true;
+        first = false;
+        bar.update(n);
+    }
+#else
+    (void)bar;
+    return false;
+#endif
+}
+
+void copy_with_buffer(tq::tqdm_bytes& bar)
+{
+    std::vector<char> buffer(chunk_size);
+    while (true)
+    {
+        ssize_t n = read(STDIN_FILENO, buffer.data(), buffer.size());
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) fail("read");
+        if (n <= 0) return;
+        if (!write_all(buffer.data(), n)) return;
+        bar.update(n);
+    }
+}
+
+int usage(const char* program)
+{
+    std::cerr << "usage: " << program << " [-s SIZE] [-N NAME] [-i]\n";
+    return 1;
+}
+
+int main(int argc, char* argv[])
+{
+    tq::index size = stdin_size();
+    std::string name;
+    auto scale = tq::unit_scale::si;
+
+    for (int opt; (opt = getopt(argc, argv, "s:N:i")) != -1;)
+    {
+        switch (opt)
+        {
+        case 's':
+            size = parse_size(optarg);
+            if (size < 0) return usage(argv[0]);
+            break;
+        case 'N': name = std::string(optarg) + " "; break;
+        case 'i': scale = tq::unit_scale::iec; break;
+        default: return usage(argv[0]);
+        }
+    }
+
+    tq::tqdm_bytes bar(size, scale);
+    bar.set_prefix(name);
+    bar.render_in_background();
+
+    if (!copy_with_splice(bar)) copy_with_buffer(bar);
+
+    bar.finish();
+    std::cerr << '\n';
+
+    if (failed_call)
+    {
+        std::cerr << argv[0] << ": " << failed_call << ": "
+                  << std::strerror(failed_errno) << '\n';
+        return 1;
+    }
+
+    return 0;
+}
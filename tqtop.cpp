@@ -0,0 +1,173 @@
+// Lists the progress bars of every running process that exported them with
+// set_shared_export(), by reading the shared memory files they publish.
+//
+//     g++ -O2 -std=c++17 tqtop.cpp -o tqtop
+//     ./tqtop          # print once
+//     ./tqtop -w 1     # refresh every second
+//
+// Options:
+//     -w SECONDS  keep refreshing, every SECONDS.
+//     -c          remove files left behind by processes that died.
+//     -p FILE     instead of printing a table, write the bars to FILE in
+//                 Prometheus text format (e.g. for node_exporter's textfile
+//                 collector). The file is replaced atomically.
+//
+// Reading never blocks or slows down the processes being watched: each bar
+// is a small file guarded by a seqlock, and the reader just retries if it
+// catches a write halfway (for a while, then skips the bar).
+
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "tqdm.hpp"
+
+bool is_alive(std::int64_t pid)
+{
+    return kill(pid, 0) == 0 || errno == EPERM;
+}
+
+double unix_time()
+{
+    using namespace std::chrono;
+    return duration<double>(system_clock::now().time_since_epoch()).count();
+}
+
+// Lists the bars of running processes, sorted by pid and creation order.
+// Files of dead processes are never read, since a process that died while
+// publishing leaves its file in a state no reader can get a snapshot of.
+std::vector<tq::shared_snapshot> live_bars(bool clean)
+{
+    std::vector<tq::shared_snapshot> bars;
+    for (const auto& file : tq::shared_files())
+    {
+        if (!is_alive(file.pid))
+        {
+            std::error_code ec;
+            if (clean) std::filesystem::remove(file.path, ec);
+            continue;
+        }
+        if (auto bar = tq::shared_progress::read(file.path))
+            bars.push_back(std::move(*bar));
+    }
+    return bars;
+}
+
+// Returns false, after saying why, if the file couldn't be written. The
+// previous file is left in place then.
+bool write_prometheus(const std::string& path,
+                      const std::vector<tq::shared_snapshot>& bars)
+{
+    auto tmp = path + ".tmp";
+    std::ofstream out(tmp);
+    tq::write_prometheus(out, bars);
+    out.close();
+    std::error_code ec;
+    if (!out)
+    {
+        std::fprintf(stderr, "tqtop: can't write %s\n", tmp.c_str());
+        std::filesystem::remove(tmp, ec);
+        return false;
+    }
+    std::filesystem::rename(tmp, path, ec);
+    if (ec)
+    {
+        std::fprintf(stderr,
+                     "tqtop: can't rename %s to %s: %s\n",
+                     tmp.c_str(),
+                     path.c_str(),
+                     ec.message().c_str());
+        std::filesystem::remove(tmp, ec);
+        return false;
+    }
+    return true;
+}
+
+void print(const std::vector<tq::shared_snapshot>& bars)
+{
+    std::printf("%8s  %-24s %7s %14s %14s %12s %9s %9s %7s\n",
+                "PID",
+                "LABEL",
+                "DONE",
+                "N",
+                "TOTAL",
+                "RATE",
+                "ELAPSED",
+                "ETA",
+                "IDLE");
+
+    double now = unix_time();
+    for (const auto& bar : bars)
+    {
+        // how long since the bar last published anything
+        double idle = now - (bar.start_time + bar.elapsed);
+        double eta = (1 - bar.progress)*bar.elapsed/bar.progress;
+
+        std::printf("%8lld  %-24.24s ", (long long)bar.pid, bar.label.c_str());
+        if (bar.total >= 0)
+            std::printf("%6.1f%% ", 100*bar.progress);
+        else
+            std::printf("%7s ", "?");
+        std::printf("%14lld ", (long long)bar.n);
+        if (bar.total >= 0)
+            std::printf("%14lld ", (long long)bar.total);
+        else
+            std::printf("%14s ", "?");
+        std::printf("%10.2f/s %8.1fs ", bar.rate, bar.elapsed);
+        if (bar.total >= 0 && bar.progress > 0)
+            std::printf("%8.1fs ", eta);
+        else
+            std::printf("%9s ", "?");
+        std::printf("%6.1fs\n", std::max(idle, 0.0));
+    }
+    if (bars.empty()) std::printf("no bars found in %s\n",
+                                  tq::shared_progress_dir().c_str());
+}
+
+int main(int argc, char* argv[])
+{
+    double interval = 0;
+    bool clean = false;
+    std::string prometheus_file;
+
+    for (int opt; (opt = getopt(argc, argv, "w:cp:")) != -1;)
+    {
+        switch (opt)
+        {
+        case 'w': interval = std::atof(optarg); break;
+        case 'c': clean = true; break;
+        case 'p': prometheus_file = optarg; break;
+        default:
+            std::fprintf(
+              stderr, "usage: %s [-w SECONDS] [-c] [-p FILE]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    bool ok = true;
+    while (true)
+    {
+        auto bars = live_bars(clean);
+        if (!prometheus_file.empty())
+        {
+            ok = write_prometheus(prometheus_file, bars);
+        }
+        else
+        {
+            if (interval > 0) std::printf("\x1b[H\x1b[2J"); // clear screen
+            print(bars);
+            std::fflush(stdout);
+        }
+        if (interval <= 0) break;
+        std::this_thread::sleep_for(std::chrono::duration<double>(interval));
+    }
+
+    return ok ? 0 : 1;
+}